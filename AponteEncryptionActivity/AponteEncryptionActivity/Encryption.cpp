@@ -1,119 +1,7263 @@
 // Encryption.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <span>
 #include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 #include <ctime>
 
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ENCRYPTION_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define ENCRYPTION_X86 0
+#endif
+
+// msvc lets any function use any intrinsic, gcc and clang need each vector kernel tagged with the isa it uses
+#if defined(_MSC_VER) && !defined(__clang__)
+#define ENCRYPTION_TARGET(isa)
+#else
+#define ENCRYPTION_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// per stage timing for --stats. a run without --stats only pays a branch per span, build with
+// ENCRYPTION_INSTRUMENTATION=0 and every ENCRYPTION_STAGE below compiles to nothing
+#if !defined(ENCRYPTION_INSTRUMENTATION)
+#define ENCRYPTION_INSTRUMENTATION 1
+#endif
+
+/// <summary>
+/// the stages the instrumentation times, spans nest (read_file maps the file) so their times are inclusive
+/// </summary>
+enum class pipeline_stage
+{
+    read_file,
+    map_file,
+    get_student_name,
+    encrypt_decrypt,
+    encrypt_decrypt_records,
+    save_data_file,
+    load_data_file,
+    count
+};
+
+const char* pipeline_stage_name(pipeline_stage stage)
+{
+    static const char* const names[] = { "read_file", "map_file", "get_student_name", "encrypt_decrypt", "encrypt_decrypt_records",
+        "save_data_file", "load_data_file" };
+    return names[static_cast<int>(stage)];
+}
+
+#if ENCRYPTION_INSTRUMENTATION
+// set before any work starts when --stats asks for a summary, spans do nothing while it is false
+bool stage_timing_enabled = false;
+
+/// <summary>
+/// running totals for one stage. each thread has its own so a span never writes a cache line another thread is using,
+/// the counters are atomics only so the summary can read them while the owning thread runs
+/// </summary>
+struct stage_totals
+{
+    std::atomic<uint64_t> calls{ 0 };
+    std::atomic<uint64_t> nanoseconds{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+
+    /// <summary>
+    /// count one span, only ever called by the owning thread so a load and a store are enough
+    /// </summary>
+    void add(uint64_t span_nanoseconds, uint64_t span_bytes)
+    {
+        calls.store(calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        nanoseconds.store(nanoseconds.load(std::memory_order_relaxed) + span_nanoseconds, std::memory_order_relaxed);
+        bytes.store(bytes.load(std::memory_order_relaxed) + span_bytes, std::memory_order_relaxed);
+    }
+};
+
+/// <summary>
+/// every stage's totals for one thread. the live sets are listed so the summary can add them up, and a thread that exits
+/// folds its totals into the retired ones first
+/// </summary>
+struct thread_stage_totals
+{
+    stage_totals stages[static_cast<int>(pipeline_stage::count)];
+
+    thread_stage_totals();
+    ~thread_stage_totals();
+
+    thread_stage_totals(const thread_stage_totals&) = delete;
+    thread_stage_totals& operator=(const thread_stage_totals&) = delete;
+};
+
+std::mutex stage_totals_mutex;
+std::vector<thread_stage_totals*> live_stage_totals;
+uint64_t retired_stage_totals[static_cast<int>(pipeline_stage::count)][3];
+
+thread_stage_totals::thread_stage_totals()
+{
+    std::lock_guard<std::mutex> lock(stage_totals_mutex);
+    live_stage_totals.push_back(this);
+}
+
+thread_stage_totals::~thread_stage_totals()
+{
+    std::lock_guard<std::mutex> lock(stage_totals_mutex);
+    for (int stage = 0; stage < static_cast<int>(pipeline_stage::count); ++stage)
+    {
+        retired_stage_totals[stage][0] += stages[stage].calls.load(std::memory_order_relaxed);
+        retired_stage_totals[stage][1] += stages[stage].nanoseconds.load(std::memory_order_relaxed);
+        retired_stage_totals[stage][2] += stages[stage].bytes.load(std::memory_order_relaxed);
+    }
+    live_stage_totals.erase(std::find(live_stage_totals.begin(), live_stage_totals.end(), this));
+}
+
+/// <summary>
+/// the calling thread's totals for stage, created on the thread's first span
+/// </summary>
+stage_totals& thread_stage(pipeline_stage stage)
+{
+    thread_local thread_stage_totals totals;
+    return totals.stages[static_cast<int>(stage)];
+}
+
+/// <summary>
+/// times one call of a stage from construction to destruction on the monotonic clock, when --stats is on
+/// </summary>
+class stage_span
+{
+public:
+    stage_span(pipeline_stage stage, uint64_t bytes)
+        : stage(stage), bytes(bytes), active(stage_timing_enabled)
+    {
+        if (active)
+        {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~stage_span()
+    {
+        if (!active)
+        {
+            return;
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        thread_stage(stage).add(static_cast<uint64_t>(elapsed), bytes);
+    }
+
+    stage_span(const stage_span&) = delete;
+    stage_span& operator=(const stage_span&) = delete;
+
+    /// <summary>
+    /// count bytes found out after the span started, like the size of a file once it is open
+    /// </summary>
+    void add_bytes(uint64_t count)
+    {
+        bytes += count;
+    }
+
+private:
+    pipeline_stage stage;
+    uint64_t bytes;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+};
+
+// time the rest of the enclosing scope as one call of stage that handled bytes bytes
+#define ENCRYPTION_STAGE(stage, bytes) stage_span encryption_stage_##stage(pipeline_stage::stage, static_cast<uint64_t>(bytes))
+// add bytes to the span ENCRYPTION_STAGE opened for stage in this scope
+#define ENCRYPTION_STAGE_BYTES(stage, bytes) encryption_stage_##stage.add_bytes(static_cast<uint64_t>(bytes))
+#else
+#define ENCRYPTION_STAGE(stage, bytes) ((void)0)
+#define ENCRYPTION_STAGE_BYTES(stage, bytes) ((void)0)
+#endif
+
+/// <summary>
+/// write the stage totals as json, a build without instrumentation writes an empty stage list
+/// </summary>
+/// <param name="filename">file to write</param>
+/// <returns>false if the file could not be written</returns>
+bool write_stage_summary(const std::string& filename)
+{
+    std::ofstream output_file(filename);
+    output_file << "{\n  \"instrumented\": " << (ENCRYPTION_INSTRUMENTATION ? "true" : "false") << ",\n  \"stages\": [";
+#if ENCRYPTION_INSTRUMENTATION
+    output_file << std::setprecision(6);
+    const char* separator = "\n";
+    std::lock_guard<std::mutex> lock(stage_totals_mutex);
+    for (int stage = 0; stage < static_cast<int>(pipeline_stage::count); ++stage)
+    {
+        uint64_t calls = retired_stage_totals[stage][0];
+        uint64_t nanoseconds = retired_stage_totals[stage][1];
+        uint64_t bytes = retired_stage_totals[stage][2];
+        for (const thread_stage_totals* totals : live_stage_totals)
+        {
+            calls += totals->stages[stage].calls.load(std::memory_order_relaxed);
+            nanoseconds += totals->stages[stage].nanoseconds.load(std::memory_order_relaxed);
+            bytes += totals->stages[stage].bytes.load(std::memory_order_relaxed);
+        }
+        if (calls == 0)
+        {
+            continue;
+        }
+        const double seconds = nanoseconds / 1e9;
+        output_file << separator << "    { \"name\": \"" << pipeline_stage_name(static_cast<pipeline_stage>(stage)) << "\", \"calls\": " << calls
+            << ", \"seconds\": " << seconds << ", \"bytes\": " << bytes << ", \"bytes_per_second\": " << (seconds > 0 ? bytes / seconds : 0.0) << " }";
+        separator = ",\n";
+    }
+#endif
+    output_file << "\n  ]\n}\n";
+    output_file.close();
+    return static_cast<bool>(output_file);
+}
+
+/// <summary>
+/// writes the stage summary when it goes out of scope, so every way out of main reports
+/// </summary>
+class stage_summary_writer
+{
+public:
+    /// <param name="filename">json file to write, empty to write nothing</param>
+    explicit stage_summary_writer(std::string filename)
+        : filename(std::move(filename))
+    {
+#if ENCRYPTION_INSTRUMENTATION
+        stage_timing_enabled = !this->filename.empty();
+#endif
+    }
+
+    ~stage_summary_writer()
+    {
+        // standard error, the pipe and range modes own standard output
+        if (!filename.empty() && !write_stage_summary(filename))
+        {
+            std::cerr << "Could not write to file." << std::endl;
+        }
+    }
+
+    stage_summary_writer(const stage_summary_writer&) = delete;
+    stage_summary_writer& operator=(const stage_summary_writer&) = delete;
+
+private:
+    std::string filename;
+};
+
+// widest vector we have a kernel for, every kernel consumes this many bytes per loop iteration
+constexpr size_t xor_stride = 64;
+
+struct key_pattern;
+
+/// <summary>
+/// signature shared by every xor kernel, phase is the key index that lines up with source[0] (the keystream position for chacha20)
+/// </summary>
+using xor_kernel = void (*)(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase);
+
+/// <summary>
+/// the key repeated out far enough that a vector kernel can load xor_stride bytes of it at any key phase
+/// </summary>
+struct key_pattern
+{
+    // the repeated key bytes, period + xor_stride long
+    std::string bytes;
+    // length of the original key, for chacha20 the length of the keystream. positions repeat every key_length bytes
+    size_t key_length = 0;
+    // smallest whole number of keys that is at least xor_stride bytes long
+    size_t period = 0;
+    // fastest kernel for this key length on this cpu
+    xor_kernel kernel = nullptr;
+    // chacha20 only: constants, key, counter (filled in per block) and nonce words
+    std::array<uint32_t, 16> chacha_state{};
+    // aes-256-ctr only: the expanded key, 15 round keys of 16 bytes
+    std::array<uint8_t, 240> aes_round_keys{};
+    // aes-256-ctr only: the counter block for keystream position 0 as a 128 bit big endian number
+    uint64_t aes_counter_high = 0;
+    uint64_t aes_counter_low = 0;
+};
+
+/// <summary>
+/// reference kernel, the original byte at a time loop. every other kernel must match it byte for byte
+/// </summary>
+void xor_scalar(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase)
+{
+    const auto key_length = pattern.key_length;
+    const char* key = pattern.bytes.data();
+
+    // transform each character based on an xor of the key modded constrained to key length using a mod
+    for (size_t i = 0; i < length; ++i)
+    {
+        destination[i] = source[i] ^ key[(phase + i) % key_length];
+    }
+}
+
+/// <summary>
+/// finish the last partial stride one byte at a time, pattern_index is already reduced below the period
+/// </summary>
+inline void xor_tail(const char* source, char* destination, size_t length, const char* pattern, size_t pattern_index)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        destination[i] = source[i] ^ pattern[pattern_index + i];
+    }
+}
+
+/// <summary>
+/// scalar fallback for any key length, walks the repeated pattern in runs so there is no division per byte
+/// </summary>
+void xor_scalar_pattern(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase)
+{
+    size_t k = phase % pattern.key_length;
+    for (size_t i = 0; i < length; )
+    {
+        const size_t run = std::min(length - i, pattern.period - k);
+        xor_tail(source + i, destination + i, run, pattern.bytes.data(), k);
+        i += run;
+        k = 0;
+    }
+}
+
+/// <summary>
+/// scalar fallback for a key length known at compile time, the modulo is by a constant so it never divides
+/// </summary>
+template <size_t KeyLength>
+void xor_scalar_fixed(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase)
+{
+    assert(pattern.key_length == KeyLength);
+
+    const char* key = pattern.bytes.data() + phase % KeyLength;
+    for (size_t i = 0; i < length; ++i)
+    {
+        destination[i] = source[i] ^ key[i % KeyLength];
+    }
+}
+
+#if ENCRYPTION_X86
+ENCRYPTION_TARGET("sse2")
+void xor_sse2(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase)
+{
+    const char* key = pattern.bytes.data();
+    const auto period = pattern.period;
+    // the only division in the kernel, after this the index just walks around the pattern
+    size_t k = phase % pattern.key_length;
+    size_t i = 0;
+
+    for (; i + xor_stride <= length; i += xor_stride)
+    {
+        for (size_t lane = 0; lane < xor_stride; lane += 16)
+        {
+            const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i + lane));
+            const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + k + lane));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i + lane), _mm_xor_si128(data, mask));
+        }
+        k += xor_stride;
+        if (k >= period)
+        {
+            k -= period;
+        }
+    }
+
+    xor_tail(source + i, destination + i, length - i, key, k);
+}
+
+ENCRYPTION_TARGET("avx2")
+void xor_avx2(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase)
+{
+    const char* key = pattern.bytes.data();
+    const auto period = pattern.period;
+    size_t k = phase % pattern.key_length;
+    size_t i = 0;
+
+    for (; i + xor_stride <= length; i += xor_stride)
+    {
+        const __m256i data_low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+        const __m256i data_high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i + 32));
+        const __m256i mask_low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(key + k));
+        const __m256i mask_high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(key + k + 32));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), _mm256_xor_si256(data_low, mask_low));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i + 32), _mm256_xor_si256(data_high, mask_high));
+        k += xor_stride;
+        if (k >= period)
+        {
+            k -= period;
+        }
+    }
+
+    xor_tail(source + i, destination + i, length - i, key, k);
+}
+
+ENCRYPTION_TARGET("avx512f")
+void xor_avx512(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase)
+{
+    const char* key = pattern.bytes.data();
+    const auto period = pattern.period;
+    size_t k = phase % pattern.key_length;
+    size_t i = 0;
+
+    for (; i + xor_stride <= length; i += xor_stride)
+    {
+        const __m512i data = _mm512_loadu_si512(source + i);
+        const __m512i mask = _mm512_loadu_si512(key + k);
+        _mm512_storeu_si512(destination + i, _mm512_xor_si512(data, mask));
+        k += xor_stride;
+        if (k >= period)
+        {
+            k -= period;
+        }
+    }
+
+    xor_tail(source + i, destination + i, length - i, key, k);
+}
+
+// when the key length divides xor_stride every stride lines up with the same key bytes,
+// so these kernels load the key once and keep it in registers for the whole buffer
+
+ENCRYPTION_TARGET("sse2")
+void xor_sse2_broadcast(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase)
+{
+    const char* key = pattern.bytes.data() + phase % pattern.key_length;
+    const __m128i mask0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+    const __m128i mask1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + 16));
+    const __m128i mask2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + 32));
+    const __m128i mask3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + 48));
+    size_t i = 0;
+
+    for (; i + xor_stride <= length; i += xor_stride)
+    {
+        const __m128i data0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+        const __m128i data1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i + 16));
+        const __m128i data2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i + 32));
+        const __m128i data3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i + 48));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_xor_si128(data0, mask0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i + 16), _mm_xor_si128(data1, mask1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i + 32), _mm_xor_si128(data2, mask2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i + 48), _mm_xor_si128(data3, mask3));
+    }
+
+    xor_tail(source + i, destination + i, length - i, key, 0);
+}
+
+ENCRYPTION_TARGET("avx2")
+void xor_avx2_broadcast(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase)
+{
+    const char* key = pattern.bytes.data() + phase % pattern.key_length;
+    const __m256i mask_low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(key));
+    const __m256i mask_high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(key + 32));
+    size_t i = 0;
+
+    for (; i + xor_stride <= length; i += xor_stride)
+    {
+        const __m256i data_low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+        const __m256i data_high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i + 32));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), _mm256_xor_si256(data_low, mask_low));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i + 32), _mm256_xor_si256(data_high, mask_high));
+    }
+
+    xor_tail(source + i, destination + i, length - i, key, 0);
+}
+
+ENCRYPTION_TARGET("avx512f")
+void xor_avx512_broadcast(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase)
+{
+    const char* key = pattern.bytes.data() + phase % pattern.key_length;
+    const __m512i mask = _mm512_loadu_si512(key);
+    size_t i = 0;
+
+    for (; i + xor_stride <= length; i += xor_stride)
+    {
+        const __m512i data = _mm512_loadu_si512(source + i);
+        _mm512_storeu_si512(destination + i, _mm512_xor_si512(data, mask));
+    }
+
+    xor_tail(source + i, destination + i, length - i, key, 0);
+}
+#endif
+
+/// <summary>
+/// instruction sets we have xor kernels for, in increasing order of preference
+/// </summary>
+enum class simd_level
+{
+    scalar,
+    sse2,
+    avx2,
+    avx512
+};
+
+/// <summary>
+/// name of an instruction set for reports
+/// </summary>
+const char* simd_level_name(simd_level level)
+{
+    static const char* const names[] = { "scalar", "sse2", "avx2", "avx512" };
+    return names[static_cast<int>(level)];
+}
+
+/// <summary>
+/// ask the cpu (and the os, for the wide register state) which of our kernels it can run
+/// </summary>
+/// <returns>best instruction set available</returns>
+simd_level detect_simd_level()
+{
+#if ENCRYPTION_X86 && defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    const bool has_sse2 = (info[3] & (1 << 26)) != 0;
+    const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+    const bool has_avx = (info[2] & (1 << 28)) != 0;
+    // the os has to save the ymm (bits 1-2) and zmm (bits 5-7) state for us to use them
+    const unsigned long long xcr0 = has_osxsave ? _xgetbv(0) : 0;
+
+    bool has_avx2 = false;
+    bool has_avx512 = false;
+    if (max_leaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        has_avx2 = has_avx && (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+        has_avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+    }
+
+    if (has_avx512)
+    {
+        return simd_level::avx512;
+    }
+    if (has_avx2)
+    {
+        return simd_level::avx2;
+    }
+    if (has_sse2)
+    {
+        return simd_level::sse2;
+    }
+#elif ENCRYPTION_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return simd_level::avx512;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return simd_level::avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return simd_level::sse2;
+    }
+#endif
+    return simd_level::scalar;
+}
+
+/// <summary>
+/// get the kernel for an instruction set that handles any key length, the scalar one where there is no vector unit
+/// </summary>
+xor_kernel get_general_xor_kernel(simd_level level)
+{
+    switch (level)
+    {
+#if ENCRYPTION_X86
+    case simd_level::avx512:
+        return xor_avx512;
+    case simd_level::avx2:
+        return xor_avx2;
+    case simd_level::sse2:
+        return xor_sse2;
+#endif
+    default:
+        return xor_scalar_pattern;
+    }
+}
+
+/// <summary>
+/// get the fastest kernel for an instruction set and key length
+/// </summary>
+xor_kernel get_xor_kernel(simd_level level, size_t key_length)
+{
+    // keys that divide the stride (1, 2, 4, 8 like "password", 16, 32, 64) never change phase between strides
+    if (xor_stride % key_length == 0)
+    {
+        switch (level)
+        {
+#if ENCRYPTION_X86
+        case simd_level::avx512:
+            return xor_avx512_broadcast;
+        case simd_level::avx2:
+            return xor_avx2_broadcast;
+        case simd_level::sse2:
+            return xor_sse2_broadcast;
+#endif
+        default:
+            break;
+        }
+
+        switch (key_length)
+        {
+        case 1: return xor_scalar_fixed<1>;
+        case 2: return xor_scalar_fixed<2>;
+        case 4: return xor_scalar_fixed<4>;
+        case 8: return xor_scalar_fixed<8>;
+        case 16: return xor_scalar_fixed<16>;
+        case 32: return xor_scalar_fixed<32>;
+        default: break;
+        }
+    }
+
+    return get_general_xor_kernel(level);
+}
+
+// detected once at startup, every key pattern picks its kernel from it
+const simd_level active_simd_level = detect_simd_level();
+
+/// <summary>
+/// sha-256 fed in pieces, so a message made of several buffers (a hmac's padded key and its message) is never copied together
+/// </summary>
+class sha256_context
+{
+public:
+    /// <summary>
+    /// hash more bytes of the message
+    /// </summary>
+    void update(std::string_view message)
+    {
+        total_length += message.length();
+        // top up a partly filled block first, then hash whole blocks straight from the message
+        if (buffered > 0)
+        {
+            const size_t count = std::min(message.length(), block.size() - buffered);
+            std::memcpy(block.data() + buffered, message.data(), count);
+            buffered += count;
+            message.remove_prefix(count);
+            if (buffered < block.size())
+            {
+                return;
+            }
+            compress(block.data());
+            buffered = 0;
+        }
+        for (; message.length() >= block.size(); message.remove_prefix(block.size()))
+        {
+            compress(reinterpret_cast<const unsigned char*>(message.data()));
+        }
+        std::memcpy(block.data(), message.data(), message.length());
+        buffered = message.length();
+    }
+
+    /// <summary>
+    /// pad the message and return its digest, the context is spent afterwards
+    /// </summary>
+    std::array<uint8_t, 32> finish()
+    {
+        // the message, a 1 bit, zeros, and the bit length fill a whole number of 64 byte blocks
+        const uint64_t bit_length = total_length * 8;
+        block[buffered++] = 0x80;
+        if (buffered > block.size() - 8)
+        {
+            std::fill(block.begin() + buffered, block.end(), 0);
+            compress(block.data());
+            buffered = 0;
+        }
+        std::fill(block.begin() + buffered, block.end() - 8, 0);
+        for (int i = 0; i < 8; ++i)
+        {
+            block[block.size() - 1 - i] = static_cast<unsigned char>(bit_length >> (8 * i));
+        }
+        compress(block.data());
+
+        std::array<uint8_t, 32> digest;
+        for (int i = 0; i < 32; ++i)
+        {
+            digest[i] = static_cast<uint8_t>(hash[i / 4] >> (24 - 8 * (i % 4)));
+        }
+        return digest;
+    }
+
+private:
+    void compress(const unsigned char* bytes)
+    {
+        static constexpr uint32_t round_constants[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+        const auto rotr = [](uint32_t value, int count) { return (value >> count) | (value << (32 - count)); };
+
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i)
+        {
+            w[i] = (uint32_t(bytes[4 * i]) << 24) | (uint32_t(bytes[4 * i + 1]) << 16) | (uint32_t(bytes[4 * i + 2]) << 8) | bytes[4 * i + 3];
+        }
+        for (int i = 16; i < 64; ++i)
+        {
+            const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = hash[0], b = hash[1], c = hash[2], d = hash[3], e = hash[4], f = hash[5], g = hash[6], h = hash[7];
+        for (int i = 0; i < 64; ++i)
+        {
+            const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + round_constants[i] + w[i];
+            const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        hash[0] += a; hash[1] += b; hash[2] += c; hash[3] += d;
+        hash[4] += e; hash[5] += f; hash[6] += g; hash[7] += h;
+    }
+
+    uint32_t hash[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    std::array<unsigned char, 64> block{};
+    size_t buffered = 0;
+    uint64_t total_length = 0;
+};
+
+/// <summary>
+/// sha-256 of a string, used to turn a passphrase into a 256 bit cipher key
+/// </summary>
+/// <param name="message">bytes to hash</param>
+/// <returns>32 byte digest</returns>
+std::array<uint8_t, 32> sha256(std::string_view message)
+{
+    sha256_context context;
+    context.update(message);
+    return context.finish();
+}
+
+/// <summary>
+/// hmac-sha-256 (rfc 2104), a digest of message that cannot be computed or checked without key
+/// </summary>
+/// <param name="key">secret key, hashed first when longer than a block</param>
+/// <param name="message">bytes to authenticate</param>
+/// <returns>32 byte tag</returns>
+std::array<uint8_t, 32> hmac_sha256(std::string_view key, std::string_view message)
+{
+    std::array<char, 64> padded_key{};
+    if (key.length() > padded_key.size())
+    {
+        const auto key_digest = sha256(key);
+        std::memcpy(padded_key.data(), key_digest.data(), key_digest.size());
+    }
+    else
+    {
+        std::memcpy(padded_key.data(), key.data(), key.length());
+    }
+
+    std::array<char, 64> inner_pad;
+    std::array<char, 64> outer_pad;
+    for (size_t i = 0; i < padded_key.size(); ++i)
+    {
+        inner_pad[i] = static_cast<char>(padded_key[i] ^ 0x36);
+        outer_pad[i] = static_cast<char>(padded_key[i] ^ 0x5c);
+    }
+
+    sha256_context inner;
+    inner.update(std::string_view(inner_pad.data(), inner_pad.size()));
+    inner.update(message);
+    const auto inner_digest = inner.finish();
+
+    sha256_context outer;
+    outer.update(std::string_view(outer_pad.data(), outer_pad.size()));
+    outer.update(std::string_view(reinterpret_cast<const char*>(inner_digest.data()), inner_digest.size()));
+    return outer.finish();
+}
+
+// keys that start with this select the chacha20 cipher, the rest of the key is the file's nonce and the passphrase
+constexpr std::string_view chacha20_key_prefix = "chacha20:";
+
+// a chacha20 keystream is 2^32 blocks of 64 bytes, positions wrap there the way they wrap at the key length for the xor cipher.
+// a 32 bit size_t cannot hold that, so there the keystream wraps early
+constexpr size_t chacha20_keystream_length = static_cast<size_t>(std::min<uint64_t>(uint64_t(64) << 32, SIZE_MAX - 63));
+
+constexpr size_t chacha20_block_size = 64;
+
+inline uint32_t rotl32(uint32_t value, int count)
+{
+    return (value << count) | (value >> (32 - count));
+}
+
+/// <summary>
+/// one chacha20 block (rfc 8439) for the key and nonce in pattern
+/// </summary>
+/// <param name="pattern">pattern built by make_key_pattern for a chacha20 key</param>
+/// <param name="counter">block counter</param>
+/// <param name="keystream">receives the 64 keystream bytes</param>
+void chacha20_block(const key_pattern& pattern, uint32_t counter, unsigned char* keystream)
+{
+    uint32_t x[16];
+    std::memcpy(x, pattern.chacha_state.data(), sizeof(x));
+    x[12] = counter;
+
+    const auto quarter_round = [&x](int a, int b, int c, int d)
+    {
+        x[a] += x[b]; x[d] = rotl32(x[d] ^ x[a], 16);
+        x[c] += x[d]; x[b] = rotl32(x[b] ^ x[c], 12);
+        x[a] += x[b]; x[d] = rotl32(x[d] ^ x[a], 8);
+        x[c] += x[d]; x[b] = rotl32(x[b] ^ x[c], 7);
+    };
+    for (int round = 0; round < 10; ++round)
+    {
+        quarter_round(0, 4, 8, 12);
+        quarter_round(1, 5, 9, 13);
+        quarter_round(2, 6, 10, 14);
+        quarter_round(3, 7, 11, 15);
+        quarter_round(0, 5, 10, 15);
+        quarter_round(1, 6, 11, 12);
+        quarter_round(2, 7, 8, 13);
+        quarter_round(3, 4, 9, 14);
+    }
+
+    for (int i = 0; i < 16; ++i)
+    {
+        const uint32_t word = x[i] + (i == 12 ? counter : pattern.chacha_state[i]);
+        keystream[4 * i] = static_cast<unsigned char>(word);
+        keystream[4 * i + 1] = static_cast<unsigned char>(word >> 8);
+        keystream[4 * i + 2] = static_cast<unsigned char>(word >> 16);
+        keystream[4 * i + 3] = static_cast<unsigned char>(word >> 24);
+    }
+}
+
+/// <summary>
+/// chacha20 a block at a time, phase is the byte position in the keystream
+/// </summary>
+void xor_chacha20_scalar(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase)
+{
+    // counters wrap at 2^32 blocks, which is where chacha20_keystream_length wraps phase
+    uint32_t counter = static_cast<uint32_t>(phase / chacha20_block_size);
+    size_t skip = phase % chacha20_block_size;
+    unsigned char keystream[chacha20_block_size];
+
+    for (size_t i = 0; i < length; )
+    {
+        chacha20_block(pattern, counter++, keystream);
+        const size_t count = std::min(chacha20_block_size - skip, length - i);
+        for (size_t j = 0; j < count; ++j)
+        {
+            destination[i + j] = static_cast<char>(source[i + j] ^ keystream[skip + j]);
+        }
+        i += count;
+        skip = 0;
+    }
+}
+
+/// <summary>
+/// run a multi block keystream kernel on every whole group of blocks and the one block kernel on the partial blocks at either end
+/// </summary>
+/// <param name="single">kernel that handles any length a block at a time</param>
+/// <param name="blocks">kernel that transforms BlockCount whole blocks starting at a block index</param>
+template <size_t BlockSize, size_t BlockCount, typename Blocks>
+inline void xor_keystream_blocks(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase, xor_kernel single, Blocks blocks)
+{
+    constexpr size_t stride = BlockCount * BlockSize;
+
+    const size_t skip = phase % BlockSize;
+    size_t i = skip == 0 ? 0 : std::min(length, BlockSize - skip);
+    single(source, destination, i, pattern, phase);
+
+    uint64_t block = (phase + i) / BlockSize;
+    for (; i + stride <= length; i += stride, block += BlockCount)
+    {
+        blocks(source + i, destination + i, pattern, block);
+    }
+
+    single(source + i, destination + i, length - i, pattern, phase + i);
+}
+
+#if ENCRYPTION_X86
+// the vector kernels spell their rounds out as macros, a lambda would not inherit the function's target isa
+#define CHACHA20_DOUBLE_ROUND(quarter_round) \
+    do { \
+        quarter_round(0, 4, 8, 12); \
+        quarter_round(1, 5, 9, 13); \
+        quarter_round(2, 6, 10, 14); \
+        quarter_round(3, 7, 11, 15); \
+        quarter_round(0, 5, 10, 15); \
+        quarter_round(1, 6, 11, 12); \
+        quarter_round(2, 7, 8, 13); \
+        quarter_round(3, 4, 9, 14); \
+    } while (0)
+
+// transpose four vectors of four 32 bit words in place, within each 128 bit lane
+#define CHACHA20_TRANSPOSE4(prefix, suffix, a, b, c, d) \
+    do { \
+        const auto t0 = prefix##_unpacklo_epi32##suffix(a, b); \
+        const auto t1 = prefix##_unpacklo_epi32##suffix(c, d); \
+        const auto t2 = prefix##_unpackhi_epi32##suffix(a, b); \
+        const auto t3 = prefix##_unpackhi_epi32##suffix(c, d); \
+        a = prefix##_unpacklo_epi64##suffix(t0, t1); \
+        b = prefix##_unpackhi_epi64##suffix(t0, t1); \
+        c = prefix##_unpacklo_epi64##suffix(t2, t3); \
+        d = prefix##_unpackhi_epi64##suffix(t2, t3); \
+    } while (0)
+
+ENCRYPTION_TARGET("sse2")
+inline __m128i rotl32_sse2(__m128i value, int count)
+{
+    return _mm_or_si128(_mm_slli_epi32(value, count), _mm_srli_epi32(value, 32 - count));
+}
+
+/// <summary>
+/// four chacha20 blocks at once, each of the 16 state words holds that word of all four blocks
+/// </summary>
+ENCRYPTION_TARGET("sse2")
+void chacha20_sse2_4blocks(const char* source, char* destination, const key_pattern& pattern, uint64_t block)
+{
+    __m128i state[16];
+    for (int i = 0; i < 16; ++i)
+    {
+        state[i] = _mm_set1_epi32(static_cast<int>(pattern.chacha_state[i]));
+    }
+    // the counter is the block index modulo 2^32
+    state[12] = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(static_cast<uint32_t>(block))), _mm_set_epi32(3, 2, 1, 0));
+
+    __m128i x[16];
+    std::memcpy(x, state, sizeof(x));
+#define CHACHA20_QUARTER_ROUND_SSE2(a, b, c, d) \
+    x[a] = _mm_add_epi32(x[a], x[b]); x[d] = rotl32_sse2(_mm_xor_si128(x[d], x[a]), 16); \
+    x[c] = _mm_add_epi32(x[c], x[d]); x[b] = rotl32_sse2(_mm_xor_si128(x[b], x[c]), 12); \
+    x[a] = _mm_add_epi32(x[a], x[b]); x[d] = rotl32_sse2(_mm_xor_si128(x[d], x[a]), 8); \
+    x[c] = _mm_add_epi32(x[c], x[d]); x[b] = rotl32_sse2(_mm_xor_si128(x[b], x[c]), 7)
+    for (int round = 0; round < 10; ++round)
+    {
+        CHACHA20_DOUBLE_ROUND(CHACHA20_QUARTER_ROUND_SSE2);
+    }
+#undef CHACHA20_QUARTER_ROUND_SSE2
+    for (int i = 0; i < 16; ++i)
+    {
+        x[i] = _mm_add_epi32(x[i], state[i]);
+    }
+
+    // turn word-major into block-major, after this x[4 * g + b] is words 4g..4g+3 of block b
+    for (int group = 0; group < 4; ++group)
+    {
+        CHACHA20_TRANSPOSE4(_mm, , x[4 * group], x[4 * group + 1], x[4 * group + 2], x[4 * group + 3]);
+    }
+    for (int block = 0; block < 4; ++block)
+    {
+        for (int group = 0; group < 4; ++group)
+        {
+            const size_t offset = block * chacha20_block_size + group * 16;
+            const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + offset));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + offset), _mm_xor_si128(data, x[4 * group + block]));
+        }
+    }
+}
+
+ENCRYPTION_TARGET("sse2")
+void xor_chacha20_sse2(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase)
+{
+    xor_keystream_blocks<chacha20_block_size, 4>(source, destination, length, pattern, phase, xor_chacha20_scalar, chacha20_sse2_4blocks);
+}
+
+/// <summary>
+/// eight chacha20 blocks at once, the 16 and 8 bit rotations are byte shuffles
+/// </summary>
+ENCRYPTION_TARGET("avx2")
+void chacha20_avx2_8blocks(const char* source, char* destination, const key_pattern& pattern, uint64_t block)
+{
+    __m256i state[16];
+    for (int i = 0; i < 16; ++i)
+    {
+        state[i] = _mm256_set1_epi32(static_cast<int>(pattern.chacha_state[i]));
+    }
+    state[12] = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(static_cast<uint32_t>(block))), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+
+    const __m256i rotate16 = _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+        13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+    const __m256i rotate8 = _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+        14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+
+    __m256i x[16];
+    std::memcpy(x, state, sizeof(x));
+#define CHACHA20_ROTL_AVX2(value, count) _mm256_or_si256(_mm256_slli_epi32(value, count), _mm256_srli_epi32(value, 32 - (count)))
+#define CHACHA20_QUARTER_ROUND_AVX2(a, b, c, d) \
+    x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rotate16); \
+    x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = CHACHA20_ROTL_AVX2(_mm256_xor_si256(x[b], x[c]), 12); \
+    x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rotate8); \
+    x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = CHACHA20_ROTL_AVX2(_mm256_xor_si256(x[b], x[c]), 7)
+    for (int round = 0; round < 10; ++round)
+    {
+        CHACHA20_DOUBLE_ROUND(CHACHA20_QUARTER_ROUND_AVX2);
+    }
+#undef CHACHA20_QUARTER_ROUND_AVX2
+#undef CHACHA20_ROTL_AVX2
+    for (int i = 0; i < 16; ++i)
+    {
+        x[i] = _mm256_add_epi32(x[i], state[i]);
+    }
+
+    // transposing within the 128 bit lanes leaves x[4 * g + b] holding words 4g..4g+3 of block b low and block b + 4 high
+    for (int group = 0; group < 4; ++group)
+    {
+        CHACHA20_TRANSPOSE4(_mm256, , x[4 * group], x[4 * group + 1], x[4 * group + 2], x[4 * group + 3]);
+    }
+    for (int block = 0; block < 4; ++block)
+    {
+        for (int half = 0; half < 2; ++half)
+        {
+            // words 0..7 come from groups 0 and 1, words 8..15 from groups 2 and 3
+            const __m256i low = x[8 * half + block];
+            const __m256i high = x[8 * half + 4 + block];
+            const __m256i first = _mm256_permute2x128_si256(low, high, 0x20);
+            const __m256i second = _mm256_permute2x128_si256(low, high, 0x31);
+
+            const size_t first_offset = block * chacha20_block_size + half * 32;
+            const size_t second_offset = first_offset + 4 * chacha20_block_size;
+            const __m256i first_data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + first_offset));
+            const __m256i second_data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + second_offset));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + first_offset), _mm256_xor_si256(first_data, first));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + second_offset), _mm256_xor_si256(second_data, second));
+        }
+    }
+}
+
+ENCRYPTION_TARGET("avx2")
+void xor_chacha20_avx2(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase)
+{
+    xor_keystream_blocks<chacha20_block_size, 8>(source, destination, length, pattern, phase, xor_chacha20_scalar, chacha20_avx2_8blocks);
+}
+
+#undef CHACHA20_TRANSPOSE4
+#undef CHACHA20_DOUBLE_ROUND
+#endif
+
+/// <summary>
+/// get the chacha20 kernel for an instruction set, avx-512 machines use the avx2 one
+/// </summary>
+xor_kernel get_chacha20_kernel(simd_level level)
+{
+    switch (level)
+    {
+#if ENCRYPTION_X86
+    case simd_level::avx512:
+    case simd_level::avx2:
+        return xor_chacha20_avx2;
+    case simd_level::sse2:
+        return xor_chacha20_sse2;
+#endif
+    default:
+        return xor_chacha20_scalar;
+    }
+}
+
+/// <summary>
+/// build a chacha20 pattern from a 256 bit key and 96 bit nonce
+/// </summary>
+/// <param name="key">32 key bytes</param>
+/// <param name="nonce">12 nonce bytes</param>
+/// <param name="level">instruction set to pick the kernel for</param>
+/// <returns>pattern whose kernel xors the chacha20 keystream</returns>
+key_pattern make_chacha20_pattern(const uint8_t* key, const uint8_t* nonce, simd_level level = active_simd_level)
+{
+    const auto load_le = [](const uint8_t* bytes)
+    {
+        return uint32_t(bytes[0]) | (uint32_t(bytes[1]) << 8) | (uint32_t(bytes[2]) << 16) | (uint32_t(bytes[3]) << 24);
+    };
+
+    key_pattern pattern;
+    // "expand 32-byte k"
+    pattern.chacha_state[0] = 0x61707865;
+    pattern.chacha_state[1] = 0x3320646e;
+    pattern.chacha_state[2] = 0x79622d32;
+    pattern.chacha_state[3] = 0x6b206574;
+    for (int i = 0; i < 8; ++i)
+    {
+        pattern.chacha_state[4 + i] = load_le(key + 4 * i);
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        pattern.chacha_state[13 + i] = load_le(nonce + 4 * i);
+    }
+    pattern.key_length = chacha20_keystream_length;
+    pattern.kernel = get_chacha20_kernel(level);
+    return pattern;
+}
+
+// keys that start with this select aes-256 in counter mode, the rest of the key is the file's nonce and the passphrase
+constexpr std::string_view aes256ctr_key_prefix = "aes256ctr:";
+
+// the 128 bit counter never wraps in a size_t of blocks, so positions only repeat where size_t does
+constexpr size_t aes256ctr_keystream_length = SIZE_MAX - 15;
+
+constexpr size_t aes_block_size = 16;
+constexpr int aes256_rounds = 14;
+
+inline uint64_t byte_swap64(uint64_t value)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    return _byteswap_uint64(value);
+#else
+    return __builtin_bswap64(value);
+#endif
+}
+
+/// <summary>
+/// the counter block for a block index, the initial counter plus the index as one 128 bit big endian number
+/// </summary>
+inline void aes_counter_block(const key_pattern& pattern, uint64_t block, unsigned char* counter)
+{
+    const uint64_t low = pattern.aes_counter_low + block;
+    const uint64_t high = pattern.aes_counter_high + (low < block ? 1 : 0);
+    for (int i = 0; i < 8; ++i)
+    {
+        counter[i] = static_cast<unsigned char>(high >> (56 - 8 * i));
+        counter[8 + i] = static_cast<unsigned char>(low >> (56 - 8 * i));
+    }
+}
+
+// the portable aes works on eight bytes at a time in a uint64_t, with no table lookups and no branches on the data,
+// so its timing does not depend on the key or the data
+constexpr uint64_t swar_low_bits = 0x0101010101010101ull;
+
+/// <summary>
+/// multiply each byte by x in gf(2^8)
+/// </summary>
+inline uint64_t swar_xtime(uint64_t value)
+{
+    return ((value & 0x7f7f7f7f7f7f7f7full) << 1) ^ (((value >> 7) & swar_low_bits) * 0x1b);
+}
+
+/// <summary>
+/// multiply each byte of a by the matching byte of b in gf(2^8)
+/// </summary>
+inline uint64_t swar_gf_multiply(uint64_t a, uint64_t b)
+{
+    uint64_t product = 0;
+    for (int bit = 0; bit < 8; ++bit)
+    {
+        // every byte whose multiplier has this bit set gets a mask of ones
+        product ^= a & ((((b >> bit) & swar_low_bits) * 0xff));
+        a = swar_xtime(a);
+    }
+    return product;
+}
+
+/// <summary>
+/// rotate each byte left
+/// </summary>
+inline uint64_t swar_rotate_bytes(uint64_t value, int count)
+{
+    const uint64_t high_mask = (0xffull >> (8 - count)) * swar_low_bits;
+    return ((value << count) & ~high_mask) | ((value >> (8 - count)) & high_mask);
+}
+
+/// <summary>
+/// the aes s-box on eight bytes: the inverse in gf(2^8) as x^254, then the affine map
+/// </summary>
+uint64_t swar_sub_bytes(uint64_t x)
+{
+    const uint64_t x2 = swar_gf_multiply(x, x);
+    const uint64_t x3 = swar_gf_multiply(x2, x);
+    const uint64_t x6 = swar_gf_multiply(x3, x3);
+    const uint64_t x12 = swar_gf_multiply(x6, x6);
+    const uint64_t x15 = swar_gf_multiply(x12, x3);
+    const uint64_t x30 = swar_gf_multiply(x15, x15);
+    const uint64_t x60 = swar_gf_multiply(x30, x30);
+    const uint64_t x120 = swar_gf_multiply(x60, x60);
+    const uint64_t x240 = swar_gf_multiply(x120, x120);
+    const uint64_t x252 = swar_gf_multiply(x240, x12);
+    const uint64_t inverse = swar_gf_multiply(x252, x2);
+    return inverse ^ swar_rotate_bytes(inverse, 1) ^ swar_rotate_bytes(inverse, 2) ^ swar_rotate_bytes(inverse, 3)
+        ^ swar_rotate_bytes(inverse, 4) ^ (0x63 * swar_low_bits);
+}
+
+/// <summary>
+/// encrypt one block with the portable constant time aes
+/// </summary>
+/// <param name="round_keys">expanded key, 16 bytes per round</param>
+/// <param name="block">16 bytes, encrypted in place</param>
+void aes256_encrypt_block_portable(const unsigned char* round_keys, unsigned char* block)
+{
+    uint64_t state[2];
+    uint64_t round_key[2];
+    std::memcpy(state, block, sizeof(state));
+    std::memcpy(round_key, round_keys, sizeof(round_key));
+    state[0] ^= round_key[0];
+    state[1] ^= round_key[1];
+
+    for (int round = 1; round <= aes256_rounds; ++round)
+    {
+        state[0] = swar_sub_bytes(state[0]);
+        state[1] = swar_sub_bytes(state[1]);
+
+        // shift rows, byte 4c + r of the column major state moves to column c - r
+        unsigned char bytes[16];
+        unsigned char shifted[16];
+        std::memcpy(bytes, state, sizeof(bytes));
+        for (int column = 0; column < 4; ++column)
+        {
+            for (int row = 0; row < 4; ++row)
+            {
+                shifted[4 * column + row] = bytes[4 * ((column + row) % 4) + row];
+            }
+        }
+        std::memcpy(state, shifted, sizeof(state));
+
+        // mix columns on two columns per word: a ^ (a0 ^ a1 ^ a2 ^ a3) ^ xtime(a ^ a rotated by one row)
+        if (round != aes256_rounds)
+        {
+            for (auto& word : state)
+            {
+                const auto rotate_rows = [](uint64_t value, int rows)
+                {
+                    const int bits = 8 * rows;
+                    const uint64_t keep = (0xffffffffull >> bits) * 0x0000000100000001ull;
+                    return ((value >> bits) & keep) | ((value << (32 - bits)) & ~keep);
+                };
+                const uint64_t next = rotate_rows(word, 1);
+                const uint64_t all = word ^ next ^ rotate_rows(word, 2) ^ rotate_rows(word, 3);
+                word ^= all ^ swar_xtime(word ^ next);
+            }
+        }
+
+        std::memcpy(round_key, round_keys + round * aes_block_size, sizeof(round_key));
+        state[0] ^= round_key[0];
+        state[1] ^= round_key[1];
+    }
+    std::memcpy(block, state, sizeof(state));
+}
+
+/// <summary>
+/// aes-256-ctr a block at a time with the portable aes, phase is the byte position in the keystream
+/// </summary>
+void xor_aes256ctr_portable(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase)
+{
+    uint64_t block = phase / aes_block_size;
+    size_t skip = phase % aes_block_size;
+    unsigned char keystream[aes_block_size];
+
+    for (size_t i = 0; i < length; )
+    {
+        aes_counter_block(pattern, block++, keystream);
+        aes256_encrypt_block_portable(pattern.aes_round_keys.data(), keystream);
+        const size_t count = std::min(aes_block_size - skip, length - i);
+        for (size_t j = 0; j < count; ++j)
+        {
+            destination[i + j] = static_cast<char>(source[i + j] ^ keystream[skip + j]);
+        }
+        i += count;
+        skip = 0;
+    }
+}
+
+#if ENCRYPTION_X86
+/// <summary>
+/// eight counter blocks through aes-ni at once, the aesenc latency of one block is hidden behind the other seven
+/// </summary>
+ENCRYPTION_TARGET("aes")
+void aes256ctr_aesni_8blocks(const char* source, char* destination, const key_pattern& pattern, uint64_t block)
+{
+    __m128i round_keys[aes256_rounds + 1];
+    for (int round = 0; round <= aes256_rounds; ++round)
+    {
+        round_keys[round] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern.aes_round_keys.data() + round * aes_block_size));
+    }
+
+    __m128i x[8];
+    for (int i = 0; i < 8; ++i)
+    {
+        const uint64_t low = pattern.aes_counter_low + block + i;
+        const uint64_t high = pattern.aes_counter_high + (low < block + i ? 1 : 0);
+        x[i] = _mm_xor_si128(_mm_set_epi64x(static_cast<long long>(byte_swap64(low)), static_cast<long long>(byte_swap64(high))), round_keys[0]);
+    }
+    for (int round = 1; round < aes256_rounds; ++round)
+    {
+        for (auto& value : x)
+        {
+            value = _mm_aesenc_si128(value, round_keys[round]);
+        }
+    }
+    for (int i = 0; i < 8; ++i)
+    {
+        const __m128i keystream = _mm_aesenclast_si128(x[i], round_keys[aes256_rounds]);
+        const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * aes_block_size));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * aes_block_size), _mm_xor_si128(data, keystream));
+    }
+}
+
+ENCRYPTION_TARGET("aes")
+void xor_aes256ctr_aesni(const char* source, char* destination, size_t length, const key_pattern& pattern, size_t phase)
+{
+    xor_keystream_blocks<aes_block_size, 8>(source, destination, length, pattern, phase, xor_aes256ctr_portable, aes256ctr_aesni_8blocks);
+}
+#endif
+
+/// <summary>
+/// true if the cpu has the aes-ni instructions
+/// </summary>
+bool detect_aes_ni()
+{
+#if ENCRYPTION_X86 && defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 25)) != 0;
+#elif ENCRYPTION_X86
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes");
+#else
+    return false;
+#endif
+}
+
+const bool active_aes_ni = detect_aes_ni();
+
+/// <summary>
+/// build an aes-256-ctr pattern from a 256 bit key and the initial 128 bit counter block
+/// </summary>
+/// <param name="key">32 key bytes</param>
+/// <param name="initial_counter">16 byte counter block for keystream position 0</param>
+/// <param name="use_aes_ni">use the aes-ni kernel, ignored where the cpu does not have it</param>
+/// <returns>pattern whose kernel xors the aes-256-ctr keystream</returns>
+key_pattern make_aes256ctr_pattern(const uint8_t* key, const uint8_t* initial_counter, bool use_aes_ni = active_aes_ni)
+{
+    key_pattern pattern;
+
+    // key expansion (fips-197 5.2) on 32 bit words, the s-box is the constant time one
+    uint8_t* w = pattern.aes_round_keys.data();
+    std::memcpy(w, key, 32);
+    uint8_t round_constant = 1;
+    for (size_t i = 8; i < 4 * (aes256_rounds + 1); ++i)
+    {
+        uint8_t word[4];
+        std::memcpy(word, w + 4 * (i - 1), 4);
+        if (i % 8 == 0 || i % 8 == 4)
+        {
+            uint64_t packed = 0;
+            std::memcpy(&packed, word, 4);
+            packed = swar_sub_bytes(packed);
+            std::memcpy(word, &packed, 4);
+        }
+        if (i % 8 == 0)
+        {
+            const uint8_t first = word[0];
+            word[0] = static_cast<uint8_t>(word[1] ^ round_constant);
+            word[1] = word[2];
+            word[2] = word[3];
+            word[3] = first;
+            round_constant = static_cast<uint8_t>((round_constant << 1) ^ ((round_constant >> 7) * 0x1b));
+        }
+        for (int j = 0; j < 4; ++j)
+        {
+            w[4 * i + j] = static_cast<uint8_t>(w[4 * (i - 8) + j] ^ word[j]);
+        }
+    }
+
+    for (int i = 0; i < 8; ++i)
+    {
+        pattern.aes_counter_high = (pattern.aes_counter_high << 8) | initial_counter[i];
+        pattern.aes_counter_low = (pattern.aes_counter_low << 8) | initial_counter[8 + i];
+    }
+    pattern.key_length = aes256ctr_keystream_length;
+    pattern.kernel = xor_aes256ctr_portable;
+#if ENCRYPTION_X86
+    if (use_aes_ni && active_aes_ni)
+    {
+        pattern.kernel = xor_aes256ctr_aesni;
+    }
+#endif
+    return pattern;
+}
+
+/// <summary>
+/// fill in a repeated key pattern for the xor kernels, reusing the pattern's buffer when it is already big enough
+/// </summary>
+/// <param name="pattern">pattern to fill</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="level">instruction set to pick the kernel for</param>
+void fill_xor_pattern(key_pattern& pattern, std::string_view key, simd_level level = active_simd_level)
+{
+    const auto key_length = key.length();
+    assert(key_length > 0);
+
+    pattern.key_length = key_length;
+    pattern.period = ((xor_stride + key_length - 1) / key_length) * key_length;
+    pattern.bytes.resize(pattern.period + xor_stride);
+    // lay the key down once and keep doubling it, rather than a division per byte
+    const size_t total = pattern.bytes.length();
+    std::memcpy(&pattern.bytes[0], key.data(), std::min(key_length, total));
+    for (size_t filled = key_length; filled < total; filled *= 2)
+    {
+        std::memcpy(&pattern.bytes[filled], pattern.bytes.data(), std::min(filled, total - filled));
+    }
+    // pick the kernel here so the hot path is a single indirect call
+    pattern.kernel = get_xor_kernel(level, key_length);
+}
+
+// hex digits of the 96 bit nonce a cipher key carries between its prefix and the passphrase, "chacha20:<nonce>:<passphrase>"
+constexpr size_t cipher_nonce_hex_length = 24;
+
+/// <summary>
+/// the length of the cipher prefix key starts with, 0 for a repeating xor key
+/// </summary>
+size_t cipher_prefix_length(std::string_view key)
+{
+    for (const auto prefix : { chacha20_key_prefix, aes256ctr_key_prefix })
+    {
+        if (key.starts_with(prefix))
+        {
+            return prefix.length();
+        }
+    }
+    return 0;
+}
+
+/// <summary>
+/// split what follows a cipher prefix into the nonce and the passphrase
+/// </summary>
+/// <param name="rest">the key after its prefix</param>
+/// <param name="nonce">receives the nonce, zero when the key has none</param>
+/// <param name="passphrase">receives the passphrase</param>
+/// <returns>false for a key written before keys carried a nonce, the zero nonce is then the one it was encrypted with</returns>
+bool split_cipher_key(std::string_view rest, std::array<uint8_t, 12>& nonce, std::string_view& passphrase)
+{
+    nonce = {};
+    passphrase = rest;
+    if (rest.length() <= cipher_nonce_hex_length || rest[cipher_nonce_hex_length] != ':')
+    {
+        return false;
+    }
+    std::array<uint8_t, 12> parsed{};
+    for (size_t i = 0; i < cipher_nonce_hex_length; ++i)
+    {
+        const char digit = rest[i];
+        const int value = digit >= '0' && digit <= '9' ? digit - '0' : digit >= 'a' && digit <= 'f' ? digit - 'a' + 10 : -1;
+        if (value < 0)
+        {
+            return false;
+        }
+        parsed[i / 2] = static_cast<uint8_t>(parsed[i / 2] << 4 | value);
+    }
+    nonce = parsed;
+    passphrase = rest.substr(cipher_nonce_hex_length + 1);
+    return true;
+}
+
+/// <summary>
+/// give a cipher key a fresh random nonce, so no two files encrypted with the same passphrase share a keystream. xor keys and keys
+/// that already carry a nonce come back unchanged
+/// </summary>
+/// <param name="key">key from the command line or a manifest</param>
+/// <returns>the key to encrypt with and to store in the file's header</returns>
+std::string add_cipher_nonce(const std::string& key)
+{
+    const size_t prefix_length = cipher_prefix_length(key);
+    std::array<uint8_t, 12> nonce;
+    std::string_view passphrase;
+    if (prefix_length == 0 || split_cipher_key(std::string_view(key).substr(prefix_length), nonce, passphrase))
+    {
+        return key;
+    }
+
+    std::random_device random;
+    std::string with_nonce = key.substr(0, prefix_length);
+    for (size_t i = 0; i < cipher_nonce_hex_length; i += 8)
+    {
+        char digits[9];
+        std::snprintf(digits, sizeof(digits), "%08x", static_cast<unsigned>(random()));
+        with_nonce += digits;
+    }
+    return with_nonce + ":" + key.substr(prefix_length);
+}
+
+/// <summary>
+/// the key to decrypt a file with: the stored key when none was given, otherwise the given one with the stored nonce filled in
+/// when it names the same cipher but no nonce of its own
+/// </summary>
+/// <param name="key">key from the command line, may be empty</param>
+/// <param name="stored_key">key line of the file's header</param>
+std::string resolve_cipher_key(const std::string& key, std::string_view stored_key)
+{
+    if (key.empty())
+    {
+        return std::string(stored_key);
+    }
+    const size_t prefix_length = cipher_prefix_length(key);
+    std::array<uint8_t, 12> nonce;
+    std::string_view passphrase;
+    if (prefix_length == 0 || !stored_key.starts_with(std::string_view(key).substr(0, prefix_length))
+        || split_cipher_key(std::string_view(key).substr(prefix_length), nonce, passphrase)
+        || !split_cipher_key(stored_key.substr(prefix_length), nonce, passphrase))
+    {
+        return key;
+    }
+    return std::string(stored_key.substr(0, prefix_length + cipher_nonce_hex_length + 1)) + key.substr(prefix_length);
+}
+
+/// <summary>
+/// build the repeated key pattern used by the xor kernels, or the cipher state for a key that starts with "chacha20:" or "aes256ctr:"
+/// </summary>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="level">instruction set to pick the kernel for</param>
+/// <returns>pattern for the key</returns>
+key_pattern make_key_pattern(std::string_view key, simd_level level = active_simd_level)
+{
+    // the cipher key is the sha-256 of the passphrase and the nonce is the one add_cipher_nonce put in the key, a key without
+    // one (written before keys carried a nonce) uses the zero nonce it was encrypted with
+    std::array<uint8_t, 12> nonce;
+    std::string_view passphrase;
+    if (key.starts_with(chacha20_key_prefix))
+    {
+        split_cipher_key(key.substr(chacha20_key_prefix.length()), nonce, passphrase);
+        const auto cipher_key = sha256(passphrase);
+        return make_chacha20_pattern(cipher_key.data(), nonce.data(), level);
+    }
+    // aes-256-ctr the same way, the nonce fills the top 96 bits of the initial counter block and the block count the rest
+    if (key.starts_with(aes256ctr_key_prefix))
+    {
+        split_cipher_key(key.substr(aes256ctr_key_prefix.length()), nonce, passphrase);
+        const auto cipher_key = sha256(passphrase);
+        uint8_t initial_counter[16] = {};
+        std::memcpy(initial_counter, nonce.data(), nonce.size());
+        return make_aes256ctr_pattern(cipher_key.data(), initial_counter, level != simd_level::scalar);
+    }
+
+    key_pattern pattern;
+    fill_xor_pattern(pattern, key, level);
+    return pattern;
+}
+
+/// <summary>
+/// encrypt or decrypt source into a caller provided buffer of the same length using a prepared key pattern
+/// </summary>
+/// <param name="source">input bytes to process</param>
+/// <param name="destination">output bytes, may be the same memory as source</param>
+/// <param name="pattern">pattern built from the key by make_key_pattern</param>
+/// <param name="key_offset">key index lined up with source[0], non zero when source continues an earlier buffer</param>
+void encrypt_decrypt(std::span<const char> source, std::span<char> destination, const key_pattern& pattern, size_t key_offset = 0)
+{
+    // the destination must be able to hold every transformed byte
+    assert(destination.size() == source.size());
+    // the pipe and record paths call this for empty pieces too, those are not worth a span
+    if (source.empty())
+    {
+        return;
+    }
+    ENCRYPTION_STAGE(encrypt_decrypt, source.size());
+
+    pattern.kernel(source.data(), destination.data(), source.size(), pattern, key_offset);
+}
+
+/// <summary>
+/// encrypt or decrypt source into a caller provided buffer of the same length using the provided key
+/// </summary>
+/// <param name="source">input bytes to process</param>
+/// <param name="destination">output bytes, may be the same memory as source</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="key_offset">key index lined up with source[0], non zero when source continues an earlier buffer</param>
+void encrypt_decrypt(std::span<const char> source, std::span<char> destination, const std::string& key, size_t key_offset = 0)
+{
+    encrypt_decrypt(source, destination, make_key_pattern(key), key_offset);
+}
+
+/// <summary>
+/// encrypt or decrypt a buffer in place using the provided key
+/// </summary>
+/// <param name="buffer">bytes to transform, overwritten with the result</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="key_offset">key index lined up with buffer[0], non zero when buffer continues an earlier one</param>
+void encrypt_decrypt(std::span<char> buffer, const std::string& key, size_t key_offset = 0)
+{
+    encrypt_decrypt(buffer, buffer, make_key_pattern(key), key_offset);
+}
+
+/// <summary>
+/// encrypt or decrypt a source string using the provided key
+/// </summary>
+/// <param name="source">input string to process</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <returns>transformed string</returns>
+std::string encrypt_decrypt(const std::string& source, const std::string& key)
+{
+    // get lengths now instead of calling the function every time.
+    // this would have most likely been inlined by the compiler, but design for perfomance.
+    const auto key_length = key.length();
+    const auto source_length = source.length();
+
+    // assert that our input data is good
+    assert(key_length > 0);
+    assert(source_length > 0);
+
+    // size the output up front and write straight into it rather than copying source first
+    std::string output(source_length, '\0');
+    encrypt_decrypt(source, output, key);
+
+    // our output length must equal our source length
+    assert(output.length() == source_length);
+
+    // return the transformed string
+    return output;
+}
+
+/// <summary>
+/// table for the byte at a time crc32c (castagnoli, reflected polynomial 0x82f63b78)
+/// </summary>
+constexpr std::array<uint32_t, 256> make_crc32c_table()
+{
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1u)));
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+constexpr std::array<uint32_t, 256> crc32c_table = make_crc32c_table();
+
+/// <summary>
+/// signature shared by the crc32c implementations, continues crc (0 to start) over more bytes
+/// </summary>
+using crc32c_function = uint32_t(*)(uint32_t crc, const char* data, size_t length);
+
+/// <summary>
+/// crc32c one byte at a time from the table, for cpus without sse4.2
+/// </summary>
+uint32_t crc32c_table_update(uint32_t crc, const char* data, size_t length)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i)
+    {
+        crc = (crc >> 8) ^ crc32c_table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff];
+    }
+    return ~crc;
+}
+
+#if ENCRYPTION_X86
+/// <summary>
+/// crc32c with the sse4.2 crc32 instruction, a word per instruction
+/// </summary>
+ENCRYPTION_TARGET("sse4.2")
+uint32_t crc32c_sse42(uint32_t crc, const char* data, size_t length)
+{
+    crc = ~crc;
+    size_t i = 0;
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t crc64 = crc;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = static_cast<uint32_t>(crc64);
+#else
+    for (; i + 4 <= length; i += 4)
+    {
+        uint32_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+#endif
+    for (; i < length; ++i)
+    {
+        crc = _mm_crc32_u8(crc, static_cast<unsigned char>(data[i]));
+    }
+    return ~crc;
+}
+#endif
+
+/// <summary>
+/// pick the crc32c implementation for this cpu
+/// </summary>
+crc32c_function detect_crc32c()
+{
+#if ENCRYPTION_X86 && defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 20)) != 0)
+    {
+        return crc32c_sse42;
+    }
+#elif ENCRYPTION_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return crc32c_sse42;
+    }
+#endif
+    return crc32c_table_update;
+}
+
+// detected once at startup like active_simd_level
+const crc32c_function active_crc32c = detect_crc32c();
+
+/// <summary>
+/// continue a crc32c over more bytes, start with crc32c_update(0, ...)
+/// </summary>
+/// <param name="crc">crc of the bytes so far</param>
+/// <param name="data">next bytes</param>
+/// <param name="length">number of bytes</param>
+/// <returns>crc of everything so far</returns>
+uint32_t crc32c_update(uint32_t crc, const char* data, size_t length)
+{
+    return active_crc32c(crc, data, length);
+}
+
+// bytes encrypt_decrypt_checksummed transforms before it checksums them, small enough that the crc reads them back from l1 cache
+constexpr size_t checksum_block_size = size_t(4) << 10;
+
+/// <summary>
+/// encrypt or decrypt and crc32c the encrypted side in the same pass, each block is checksummed while it is still in l1 cache
+/// instead of reading the whole buffer from memory a second time
+/// </summary>
+/// <param name="source">input bytes to process</param>
+/// <param name="destination">output bytes, may be the same memory as source</param>
+/// <param name="pattern">pattern built from the key by make_key_pattern</param>
+/// <param name="key_offset">key index lined up with source[0]</param>
+/// <param name="crc">crc of the encrypted bytes before these, 0 to start</param>
+/// <param name="checksum_source">true when decrypting, the crc is of the encrypted source rather than the destination</param>
+/// <returns>crc of the encrypted bytes so far</returns>
+uint32_t encrypt_decrypt_checksummed(std::span<const char> source, std::span<char> destination, const key_pattern& pattern, size_t key_offset, uint32_t crc, bool checksum_source)
+{
+    assert(destination.size() == source.size());
+    if (source.empty())
+    {
+        return crc;
+    }
+    ENCRYPTION_STAGE(encrypt_decrypt, source.size());
+
+    for (size_t offset = 0; offset < source.size(); offset += checksum_block_size)
+    {
+        const size_t count = std::min(checksum_block_size, source.size() - offset);
+        // the source has to be summed before the kernel runs in case it is transformed in place
+        if (checksum_source)
+        {
+            crc = crc32c_update(crc, source.data() + offset, count);
+        }
+        pattern.kernel(source.data() + offset, destination.data() + offset, count, pattern, (key_offset + offset) % pattern.key_length);
+        if (!checksum_source)
+        {
+            crc = crc32c_update(crc, destination.data() + offset, count);
+        }
+    }
+    return crc;
+}
+
+// bytes each thread transforms at a time in the parallel path, small enough to stay in a core's l2 cache
+constexpr size_t default_chunk_size = size_t(256) << 10;
+
+/// <summary>
+/// fixed set of worker threads that split an indexed loop between them
+/// </summary>
+class thread_pool
+{
+public:
+    /// <summary>
+    /// start the workers, the calling thread also works so thread_count - 1 threads are created
+    /// </summary>
+    /// <param name="thread_count">threads to run loops on, 0 for one per hardware thread</param>
+    explicit thread_pool(size_t thread_count = 0)
+    {
+        if (thread_count == 0)
+        {
+            thread_count = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 1; i < thread_count; ++i)
+        {
+            workers.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            stopping = true;
+        }
+        job_ready.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    /// <summary>
+    /// number of threads a loop runs on, including the caller
+    /// </summary>
+    size_t size() const
+    {
+        return workers.size() + 1;
+    }
+
+    /// <summary>
+    /// run task(i) for every i in [0, count) and return once they have all finished. if a task throws, no new indexes are
+    /// started and the first exception is rethrown here once every thread is out of the task
+    /// </summary>
+    /// <param name="count">number of indexes</param>
+    /// <param name="task">work for one index, called concurrently from several threads</param>
+    void parallel_for(size_t count, const std::function<void(size_t)>& task)
+    {
+        // one loop at a time, a second caller waits its turn
+        std::lock_guard<std::mutex> submit_lock(submit_mutex);
+
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            current_task = &task;
+            task_count = count;
+            next_index.store(0);
+            busy_workers = workers.size();
+            ++generation;
+        }
+        job_ready.notify_all();
+
+        run_indexes(task, count);
+
+        // the task is owned by the caller, so no worker may still be inside it when we return, not even by an exception
+        std::unique_lock<std::mutex> lock(pool_mutex);
+        job_done.wait(lock, [this] { return busy_workers == 0; });
+        current_task = nullptr;
+        if (task_exception)
+        {
+            std::rethrow_exception(std::exchange(task_exception, nullptr));
+        }
+    }
+
+private:
+    void run_indexes(const std::function<void(size_t)>& task, size_t count)
+    {
+        try
+        {
+            for (size_t i = next_index.fetch_add(1); i < count; i = next_index.fetch_add(1))
+            {
+                task(i);
+            }
+        }
+        catch (...)
+        {
+            // keep the first exception for parallel_for to rethrow and let every thread run out of indexes
+            next_index.store(count);
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            if (!task_exception)
+            {
+                task_exception = std::current_exception();
+            }
+        }
+    }
+
+    void worker_loop()
+    {
+        size_t seen_generation = 0;
+        for (;;)
+        {
+            const std::function<void(size_t)>* task = nullptr;
+            size_t count = 0;
+            {
+                std::unique_lock<std::mutex> lock(pool_mutex);
+                job_ready.wait(lock, [&] { return stopping || generation != seen_generation; });
+                if (stopping)
+                {
+                    return;
+                }
+                seen_generation = generation;
+                task = current_task;
+                count = task_count;
+            }
+
+            run_indexes(*task, count);
+
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            if (--busy_workers == 0)
+            {
+                job_done.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex submit_mutex;
+    std::mutex pool_mutex;
+    std::condition_variable job_ready;
+    std::condition_variable job_done;
+    const std::function<void(size_t)>* current_task = nullptr;
+    size_t task_count = 0;
+    std::atomic<size_t> next_index{ 0 };
+    // first exception a task threw in the current loop, guarded by pool_mutex
+    std::exception_ptr task_exception;
+    size_t busy_workers = 0;
+    size_t generation = 0;
+    bool stopping = false;
+};
+
+/// <summary>
+/// encrypt or decrypt source into destination on every thread of a pool. the output is identical to the serial path
+/// </summary>
+/// <param name="source">input bytes to process</param>
+/// <param name="destination">output bytes, may be the same memory as source</param>
+/// <param name="pattern">pattern built from the key by make_key_pattern</param>
+/// <param name="pool">threads to run on</param>
+/// <param name="chunk_size">bytes each thread transforms at a time</param>
+/// <param name="key_offset">key index lined up with source[0]</param>
+void encrypt_decrypt_parallel(std::span<const char> source, std::span<char> destination, const key_pattern& pattern, thread_pool& pool, size_t chunk_size = default_chunk_size, size_t key_offset = 0)
+{
+    assert(destination.size() == source.size());
+    assert(chunk_size > 0);
+
+    const size_t chunk_count = (source.size() + chunk_size - 1) / chunk_size;
+    if (chunk_count < 2 || pool.size() == 1)
+    {
+        encrypt_decrypt(source, destination, pattern, key_offset);
+        return;
+    }
+
+    pool.parallel_for(chunk_count, [&](size_t chunk)
+    {
+        // every chunk starts at a known position, so its key phase is just that position
+        const size_t begin = chunk * chunk_size;
+        const size_t length = std::min(chunk_size, source.size() - begin);
+        encrypt_decrypt(source.subspan(begin, length), destination.subspan(begin, length), pattern, key_offset + begin);
+    });
+}
+
+/// <summary>
+/// many small records in structure of arrays form: the record bytes back to back in one buffer, the keys back to back in
+/// another, and offset arrays that say where each one starts. record i is data[record_offsets[i], record_offsets[i + 1])
+/// and its key is keys[key_offsets[i], key_offsets[i + 1]), so both offset arrays hold one more entry than there are records
+/// </summary>
+struct record_batch
+{
+    std::span<const char> data;
+    std::span<const uint32_t> record_offsets;
+    std::span<const char> keys;
+    std::span<const uint32_t> key_offsets;
+
+    size_t size() const
+    {
+        return record_offsets.empty() ? 0 : record_offsets.size() - 1;
+    }
+};
+
+// records encrypt_decrypt_records builds key patterns for at a time, before it transforms any of them
+constexpr size_t record_group_size = 8;
+
+/// <summary>
+/// the key of record i of a batch
+/// </summary>
+std::string_view record_key(const record_batch& batch, size_t record)
+{
+    return std::string_view(batch.keys.data() + batch.key_offsets[record], batch.key_offsets[record + 1] - batch.key_offsets[record]);
+}
+
+/// <summary>
+/// check that every record in a range has a key it can be encrypted with. a chacha20 or aes256ctr key must carry its own nonce
+/// (add_cipher_nonce), otherwise every record with the same passphrase would get the same keystream
+/// </summary>
+/// <returns>false if a key is empty or a cipher key has no nonce</returns>
+bool has_usable_record_keys(const record_batch& batch, size_t first, size_t last)
+{
+    for (size_t record = first; record < last; ++record)
+    {
+        const std::string_view key = record_key(batch, record);
+        const size_t prefix_length = cipher_prefix_length(key);
+        std::array<uint8_t, 12> nonce;
+        std::string_view passphrase;
+        if (key.empty() || (prefix_length != 0 && !split_cipher_key(key.substr(prefix_length), nonce, passphrase)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// <summary>
+/// encrypt or decrypt every record of a batch into an output arena laid out like batch.data. the key patterns of a group of
+/// records are built first, reusing the one before when a key repeats, then each record is one kernel call. the work per
+/// record is that kernel call plus a pattern where its key changes, so the gain over encrypt_decrypt per record is the string
+/// and pattern allocations it saves, not wider vectors. xor patterns keep their buffers from group to group, so after the
+/// first group xor keys allocate nothing
+/// </summary>
+/// <param name="batch">records and their keys</param>
+/// <param name="output">arena receiving the transformed records, batch.data.size() bytes</param>
+/// <param name="first">first record to transform</param>
+/// <param name="last">one past the last record to transform</param>
+/// <returns>false, with nothing transformed, if a record's key is not usable (see has_usable_record_keys)</returns>
+bool encrypt_decrypt_records(const record_batch& batch, std::span<char> output, size_t first, size_t last)
+{
+    assert(output.size() == batch.data.size());
+    assert(batch.key_offsets.size() == batch.record_offsets.size());
+    assert(last <= batch.size());
+    if (!has_usable_record_keys(batch, first, last))
+    {
+        return false;
+    }
+    if (last <= first)
+    {
+        return true;
+    }
+    ENCRYPTION_STAGE(encrypt_decrypt_records, batch.record_offsets[last] - batch.record_offsets[first]);
+
+    // the patterns keep their buffers from group to group, so after the first group nothing is allocated.
+    // slot 0 carries the last pattern of the previous group, so one more slot than a group needs
+    key_pattern patterns[record_group_size + 1];
+    std::string_view pattern_keys[record_group_size + 1];
+    size_t pattern_of[record_group_size];
+    size_t built = 0;
+
+    for (size_t group = first; group < last; group += record_group_size)
+    {
+        const size_t count = std::min(record_group_size, last - group);
+
+        // keep the previous group's last pattern for this group's first record to match
+        if (built > 1)
+        {
+            std::swap(patterns[0], patterns[built - 1]);
+            pattern_keys[0] = pattern_keys[built - 1];
+        }
+        built = std::min<size_t>(built, 1);
+
+        // first pass: the key patterns, only where a key differs from the one before it
+        for (size_t i = 0; i < count; ++i)
+        {
+            const std::string_view key = record_key(batch, group + i);
+            if (built == 0 || key != pattern_keys[built - 1])
+            {
+                if (cipher_prefix_length(key) != 0)
+                {
+                    patterns[built] = make_key_pattern(key);
+                }
+                else
+                {
+                    fill_xor_pattern(patterns[built], key);
+                }
+                pattern_keys[built++] = key;
+            }
+            pattern_of[i] = built - 1;
+        }
+
+        // second pass: the records, each a single kernel call
+        for (size_t i = 0; i < count; ++i)
+        {
+            const size_t record = group + i;
+            const size_t begin = batch.record_offsets[record];
+            const size_t length = batch.record_offsets[record + 1] - begin;
+            const key_pattern& pattern = patterns[pattern_of[i]];
+            pattern.kernel(batch.data.data() + begin, output.data() + begin, length, pattern, 0);
+        }
+    }
+    return true;
+}
+
+/// <summary>
+/// encrypt or decrypt every record of a batch, see encrypt_decrypt_records above
+/// </summary>
+/// <returns>false, with nothing transformed, if a record's key is not usable</returns>
+bool encrypt_decrypt_records(const record_batch& batch, std::span<char> output)
+{
+    return encrypt_decrypt_records(batch, output, 0, batch.size());
+}
+
+// records each thread takes at a time in encrypt_decrypt_records_parallel
+constexpr size_t records_per_task = 4096;
+
+/// <summary>
+/// encrypt or decrypt every record of a batch with the records split between the pool's threads
+/// </summary>
+/// <returns>false, with nothing transformed, if a record's key is not usable</returns>
+bool encrypt_decrypt_records_parallel(const record_batch& batch, std::span<char> output, thread_pool& pool)
+{
+    // every key is checked before any task starts, so a bad key cannot leave some tasks' records transformed
+    if (!has_usable_record_keys(batch, 0, batch.size()))
+    {
+        return false;
+    }
+    const size_t task_count = (batch.size() + records_per_task - 1) / records_per_task;
+    pool.parallel_for(task_count, [&](size_t task)
+    {
+        const size_t first = task * records_per_task;
+        encrypt_decrypt_records(batch, output, first, std::min(batch.size(), first + records_per_task));
+    });
+    return true;
+}
+
+/// <summary>
+/// thread pool for uneven work, each worker has its own task deque and steals from the others when it runs dry
+/// </summary>
+class work_stealing_pool
+{
+public:
+    /// <summary>
+    /// start the workers
+    /// </summary>
+    /// <param name="thread_count">worker threads, 0 for one per hardware thread</param>
+    explicit work_stealing_pool(size_t thread_count = 0)
+    {
+        if (thread_count == 0)
+        {
+            thread_count = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < thread_count; ++i)
+        {
+            queues.push_back(std::make_unique<task_queue>());
+        }
+        for (size_t i = 0; i < thread_count; ++i)
+        {
+            workers.emplace_back([this, i] { worker_loop(i); });
+        }
+    }
+
+    ~work_stealing_pool()
+    {
+        // a task exception nobody collected with wait_idle is dropped here, a destructor must not throw
+        wait_for_tasks();
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        work_ready.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    work_stealing_pool(const work_stealing_pool&) = delete;
+    work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+    size_t size() const
+    {
+        return workers.size();
+    }
+
+    /// <summary>
+    /// queue a task. from inside a task it goes on the current worker's own deque, so related work stays on one core until someone steals it
+    /// </summary>
+    void submit(std::function<void()> task)
+    {
+        pending.fetch_add(1);
+        const size_t index = current_pool == this ? current_worker : next_queue.fetch_add(1) % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            ++queued;
+        }
+        work_ready.notify_one();
+    }
+
+    /// <summary>
+    /// block until every submitted task, and every task they submitted, has finished. if a task threw, the first exception
+    /// is rethrown here, the other tasks still ran
+    /// </summary>
+    void wait_idle()
+    {
+        std::unique_lock<std::mutex> lock = wait_for_tasks();
+        if (task_exception)
+        {
+            std::rethrow_exception(std::exchange(task_exception, nullptr));
+        }
+    }
+
+private:
+    std::unique_lock<std::mutex> wait_for_tasks()
+    {
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        all_done.wait(lock, [this] { return pending.load() == 0; });
+        return lock;
+    }
+
+    struct task_queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool take_task(size_t index, std::function<void()>& task)
+    {
+        // newest of our own first, it is the most likely to still be in cache
+        {
+            auto& own = *queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        // then the oldest of someone else's, which tends to be the biggest piece of work they have left
+        for (size_t offset = 1; offset < queues.size(); ++offset)
+        {
+            auto& victim = *queues[(index + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker_loop(size_t index)
+    {
+        current_pool = this;
+        current_worker = index;
+
+        for (;;)
+        {
+            std::function<void()> task;
+            if (take_task(index, task))
+            {
+                {
+                    std::lock_guard<std::mutex> lock(sleep_mutex);
+                    --queued;
+                }
+                try
+                {
+                    task();
+                }
+                catch (...)
+                {
+                    // a task that throws still counts as finished, or wait_idle would never return
+                    std::lock_guard<std::mutex> lock(sleep_mutex);
+                    if (!task_exception)
+                    {
+                        task_exception = std::current_exception();
+                    }
+                }
+                if (pending.fetch_sub(1) == 1)
+                {
+                    std::lock_guard<std::mutex> lock(sleep_mutex);
+                    all_done.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            work_ready.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping)
+            {
+                return;
+            }
+        }
+    }
+
+    static thread_local work_stealing_pool* current_pool;
+    static thread_local size_t current_worker;
+
+    std::vector<std::unique_ptr<task_queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next_queue{ 0 };
+    std::atomic<size_t> pending{ 0 };
+    std::mutex sleep_mutex;
+    std::condition_variable work_ready;
+    std::condition_variable all_done;
+    size_t queued = 0;
+    // first exception a task threw since the last wait_idle, guarded by sleep_mutex
+    std::exception_ptr task_exception;
+    bool stopping = false;
+};
+
+thread_local work_stealing_pool* work_stealing_pool::current_pool = nullptr;
+thread_local size_t work_stealing_pool::current_worker = 0;
+
+/// <summary>
+/// read only view of a whole file, mapped into memory so the page cache is read directly instead of copied
+/// </summary>
+class mapped_file
+{
+public:
+    /// <summary>
+    /// map filename read only, check is_open to see if it worked
+    /// </summary>
+    /// <param name="filename">file to map</param>
+    explicit mapped_file(const std::string& filename)
+    {
+        ENCRYPTION_STAGE(map_file, 0);
+#if defined(_WIN32)
+        // sequential scan is the windows equivalent of MADV_SEQUENTIAL, it makes the cache manager read ahead harder
+        file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_handle == INVALID_HANDLE_VALUE)
+        {
+            return;
+        }
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file_handle, &file_size))
+        {
+            return;
+        }
+        mapped_size = static_cast<size_t>(file_size.QuadPart);
+        opened = true;
+
+        // an empty file cannot be mapped, but it is still a valid (empty) view
+        if (mapped_size == 0)
+        {
+            return;
+        }
+
+        mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping_handle != nullptr)
+        {
+            mapped_data = static_cast<const char*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+        }
+#else
+        const int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) == 0)
+        {
+            mapped_size = static_cast<size_t>(file_stat.st_size);
+            opened = true;
+
+            // an empty file cannot be mapped, but it is still a valid (empty) view
+            if (mapped_size > 0)
+            {
+                void* address = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (address != MAP_FAILED)
+                {
+                    mapped_data = static_cast<const char*>(address);
+                    // we walk the file front to back once, so ask for aggressive read ahead
+                    madvise(address, mapped_size, MADV_SEQUENTIAL);
+                }
+            }
+        }
+
+        // the mapping keeps its own reference to the file
+        close(fd);
+#endif
+
+        if (mapped_size > 0 && mapped_data == nullptr)
+        {
+            opened = false;
+            mapped_size = 0;
+        }
+        ENCRYPTION_STAGE_BYTES(map_file, mapped_size);
+    }
+
+    ~mapped_file()
+    {
+        release();
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    mapped_file(mapped_file&& other) noexcept
+    {
+        take(other);
+    }
+
+    mapped_file& operator=(mapped_file&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            take(other);
+        }
+        return *this;
+    }
+
+    /// <summary>
+    /// true when the file was opened and mapped
+    /// </summary>
+    bool is_open() const
+    {
+        return opened;
+    }
+
+    /// <summary>
+    /// the file contents, valid for as long as this object lives
+    /// </summary>
+    std::string_view view() const
+    {
+        return std::string_view(mapped_data, mapped_size);
+    }
+
+private:
+    void release()
+    {
+#if defined(_WIN32)
+        if (mapped_data != nullptr)
+        {
+            UnmapViewOfFile(mapped_data);
+        }
+        if (mapping_handle != nullptr)
+        {
+            CloseHandle(mapping_handle);
+        }
+        if (file_handle != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file_handle);
+        }
+        mapping_handle = nullptr;
+        file_handle = INVALID_HANDLE_VALUE;
+#else
+        if (mapped_data != nullptr)
+        {
+            munmap(const_cast<char*>(mapped_data), mapped_size);
+        }
+#endif
+        mapped_data = nullptr;
+        mapped_size = 0;
+        opened = false;
+    }
+
+    void take(mapped_file& other)
+    {
+        mapped_data = other.mapped_data;
+        mapped_size = other.mapped_size;
+        opened = other.opened;
+#if defined(_WIN32)
+        file_handle = other.file_handle;
+        mapping_handle = other.mapping_handle;
+        other.file_handle = INVALID_HANDLE_VALUE;
+        other.mapping_handle = nullptr;
+#endif
+        other.mapped_data = nullptr;
+        other.mapped_size = 0;
+        other.opened = false;
+    }
+
+    const char* mapped_data = nullptr;
+    size_t mapped_size = 0;
+    bool opened = false;
+#if defined(_WIN32)
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = nullptr;
+#endif
+};
+
+/// <summary>
+/// how read_whole_file should treat the page cache
+/// </summary>
+struct file_read_hints
+{
+    // let go of the file's cached pages once it is read, so reading a big input once does not push out everything else
+    bool drop_cache = false;
+    // bypass the page cache altogether (O_DIRECT, FILE_FLAG_NO_BUFFERING), for data that is read only once
+    bool direct = false;
+};
+
+// bytes asked for per read call, large enough that the per call cost disappears
+constexpr size_t read_chunk_size = size_t(8) << 20;
+// direct reads need their buffer, offset and length aligned to the device block, a page covers every common device
+constexpr size_t direct_io_alignment = 4096;
+
+/// <summary>
+/// read a whole file into contents, sized from the file system first so the string is allocated exactly once
+/// </summary>
+/// <param name="filename">file to read</param>
+/// <param name="contents">receives the file</param>
+/// <param name="hints">page cache behaviour</param>
+/// <returns>false if the file could not be opened or read</returns>
+bool read_whole_file(const std::string& filename, std::string& contents, const file_read_hints& hints = {})
+{
+    ENCRYPTION_STAGE(read_file, 0);
+    // direct reads land in an aligned bounce buffer and are copied out, a std::string's buffer is not page aligned
+    std::vector<char> bounce;
+    char* aligned = nullptr;
+    const auto make_bounce = [&]
+    {
+        bounce.resize(read_chunk_size + direct_io_alignment);
+        const auto address = reinterpret_cast<uintptr_t>(bounce.data());
+        aligned = bounce.data() + ((direct_io_alignment - address % direct_io_alignment) % direct_io_alignment);
+    };
+
+#if defined(_WIN32)
+    // windows has no call to drop one file's cached pages, a direct read is how to keep the cache untouched there
+    const DWORD flags = FILE_FLAG_SEQUENTIAL_SCAN | (hints.direct ? FILE_FLAG_NO_BUFFERING : 0);
+    const HANDLE file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size)) {
+        CloseHandle(file_handle);
+        return false;
+    }
+    contents.resize(static_cast<size_t>(file_size.QuadPart));
+    if (hints.direct) {
+        make_bounce();
+    }
+
+    size_t done = 0;
+    bool ok = true;
+    while (done < contents.length()) {
+        char* target = hints.direct ? aligned : &contents[done];
+        const size_t wanted = hints.direct ? read_chunk_size : std::min(read_chunk_size, contents.length() - done);
+        DWORD got = 0;
+        if (!ReadFile(file_handle, target, static_cast<DWORD>(wanted), &got, nullptr)) {
+            ok = false;
+            break;
+        }
+        if (got == 0) {
+            break;
+        }
+        const size_t count = std::min<size_t>(got, contents.length() - done);
+        if (hints.direct) {
+            std::memcpy(&contents[done], aligned, count);
+        }
+        done += count;
+    }
+    CloseHandle(file_handle);
+#else
+    bool direct = hints.direct;
+    int fd = -1;
+#if defined(O_DIRECT)
+    if (direct) {
+        fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    }
+#endif
+    if (fd < 0) {
+        // not every file system takes O_DIRECT (tmpfs refuses it), read through the cache there
+        direct = false;
+        fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        return false;
+    }
+    contents.resize(static_cast<size_t>(file_stat.st_size));
+    if (direct) {
+        make_bounce();
+    }
+    else {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    size_t done = 0;
+    bool ok = true;
+    while (done < contents.length()) {
+        char* target = direct ? aligned : &contents[done];
+        const size_t wanted = direct ? read_chunk_size : std::min(read_chunk_size, contents.length() - done);
+        const ssize_t got = read(fd, target, wanted);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            ok = false;
+            break;
+        }
+        if (got == 0) {
+            break;
+        }
+        const size_t count = std::min(static_cast<size_t>(got), contents.length() - done);
+        if (direct) {
+            std::memcpy(&contents[done], aligned, count);
+        }
+        done += count;
+    }
+    if (hints.drop_cache && !direct) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    close(fd);
+#endif
+
+    // the file shrank while it was read
+    contents.resize(done);
+    ENCRYPTION_STAGE_BYTES(read_file, done);
+    return ok;
+}
+
+std::string read_file(const std::string& filename, const file_read_hints& hints = {})
+{
+    try {
+        std::string file_text;
+        if (!hints.drop_cache && !hints.direct) {
+            // map the file and copy the view out once, callers that can use the view directly should map it themselves
+            const mapped_file input_file(filename);
+            if (input_file.is_open()) {
+                file_text.assign(input_file.view());
+                return file_text;
+            }
+        }
+        // a mapping cannot keep out of the page cache, so cache hints take the sized read path
+        else if (read_whole_file(filename, file_text, hints)) {
+            return file_text;
+        }
+        // the default text only when there is no file
+        file_text = "Raymond Aponte\nThis is my test string.\n";
+        // Return necessary information
+        return file_text;
+    }
+    catch (...) {
+        std::cout << "Could not read file." << std::endl;
+    }
+    return std::string();
+}
+
+std::string get_student_name(std::string_view string_data)
+{
+    std::string student_name;
+    ENCRYPTION_STAGE(get_student_name, 0);
+
+    // find the first newline
+    size_t pos = string_data.find('\n');
+    // did we find a newline
+    if (pos != std::string_view::npos)
+    { // we did, so copy that substring as the student name, without the carriage return of a crlf file
+        if (pos > 0 && string_data[pos - 1] == '\r')
+        {
+            --pos;
+        }
+        student_name = string_data.substr(0, pos);
+    }
+    ENCRYPTION_STAGE_BYTES(get_student_name, student_name.length());
+
+    return student_name;
+}
+
+/// <summary>
+/// split a file written by save_data_file into the student name and the data after the date and key lines
+/// </summary>
+/// <param name="file_data">the whole file</param>
+/// <param name="student_name">line 1</param>
+/// <param name="data">everything after line 3, a view into file_data</param>
+/// <returns>false if the file does not have the three header lines</returns>
+bool split_data_file(std::string_view file_data, std::string& student_name, std::string_view& data)
+{
+    size_t position = 0;
+    for (int line = 0; line < 3; ++line)
+    {
+        position = file_data.find('\n', position);
+        if (position == std::string_view::npos)
+        {
+            return false;
+        }
+        ++position;
+    }
+
+    student_name = get_student_name(file_data);
+    data = file_data.substr(position);
+    return true;
+}
+
+/// <summary>
+/// format today's local date the way the data file header stores it (yyyy-mm-dd)
+/// </summary>
+/// <param name="time_buf">buffer to receive the date</param>
+/// <param name="size">size of the buffer</param>
+/// <returns>length of the formatted date</returns>
+size_t format_current_date(char* time_buf, size_t size)
+{
+    struct tm ltm;
+    // Need localized time for this method
+    time_t now = time(0);
+#if defined(_WIN32)
+    localtime_s(&ltm, &now);
+#else
+    localtime_r(&now, &ltm);
+#endif
+    // Formats the date as required
+    return strftime(time_buf, size, "%Y-%m-%d", &ltm);
+}
+
+#if !defined(_WIN32)
+/// <summary>
+/// write every buffer in order with as few writev calls as the kernel allows, retrying short writes
+/// </summary>
+/// <param name="fd">file to write to</param>
+/// <param name="buffers">buffers to write, adjusted in place as they are consumed</param>
+/// <param name="count">number of buffers</param>
+/// <returns>true if everything was written</returns>
+bool write_all_vectored(int fd, struct iovec* buffers, int count)
+{
+    while (count > 0)
+    {
+        const ssize_t written = writev(fd, buffers, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        // skip the buffers that were written completely and trim the one that was written in part
+        auto remaining = static_cast<size_t>(written);
+        while (count > 0 && remaining >= buffers->iov_len)
+        {
+            remaining -= buffers->iov_len;
+            ++buffers;
+            --count;
+        }
+        if (count > 0)
+        {
+            buffers->iov_base = static_cast<char*>(buffers->iov_base) + remaining;
+            buffers->iov_len -= remaining;
+        }
+    }
+    return true;
+}
+#endif
+
+void save_data_file(const std::string& filename, const std::string& student_name, const std::string& key, std::string_view data)
+{
+    ENCRYPTION_STAGE(save_data_file, data.length());
+
+    // Char buffer to store formatted time, with room for the newlines either side of it
+    char time_buf[80];
+    time_buf[0] = '\n';
+    const size_t time_length = format_current_date(time_buf + 1, sizeof(time_buf) - 2) + 1;
+    time_buf[time_length] = '\n';
+
+    try {
+#if defined(_WIN32)
+        std::ofstream output_file(filename);
+        //  Line 1: student name
+        output_file << student_name;
+        //  Line 2: timestamp (yyyy-mm-dd)
+        output_file.write(time_buf, static_cast<std::streamsize>(time_length + 1));
+        //  Line 3: key used
+        output_file << key << "\n";
+        //  Line 4+: data
+        output_file.write(data.data(), static_cast<std::streamsize>(data.length()));
+
+        output_file.close();
+        if (!output_file) {
+            std::cout << "Could not write to file." << std::endl;
+        }
+#else
+        const int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            std::cout << "Could not write to file." << std::endl;
+            return;
+        }
+
+        // the header pieces and the data go out in one writev straight from where they already are, nothing is copied
+        char newline = '\n';
+        struct iovec buffers[] = {
+            //  Line 1: student name
+            { const_cast<char*>(student_name.data()), student_name.length() },
+            //  Line 2: timestamp (yyyy-mm-dd), with the newline that ends line 1
+            { time_buf, time_length + 1 },
+            //  Line 3: key used
+            { const_cast<char*>(key.data()), key.length() },
+            { &newline, 1 },
+            //  Line 4+: data
+            { const_cast<char*>(data.data()), data.length() },
+        };
+        const bool written = write_all_vectored(fd, buffers, static_cast<int>(std::size(buffers)));
+
+        if (close(fd) != 0 || !written) {
+            std::cout << "Could not write to file." << std::endl;
+        }
+#endif
+    }
+    catch (...) {
+        std::cout << "Could not write to file." << std::endl;
+    }
+}
+
+/// <summary>
+/// the three header lines save_data_file puts in front of the data
+/// </summary>
+/// <param name="student_name">line 1</param>
+/// <param name="key">line 3</param>
+std::string format_data_file_header(const std::string& student_name, const std::string& key)
+{
+    char time_buf[80];
+    format_current_date(time_buf, sizeof(time_buf));
+    return student_name + "\n" + time_buf + "\n" + key + "\n";
+}
+
+/// <summary>
+/// a file created at a fixed size and mapped writable, so bytes stored into it reach the disk through page cache writeback
+/// </summary>
+class mapped_output_file
+{
+public:
+    /// <summary>
+    /// create or truncate filename, size it and map it, check is_open to see if it worked
+    /// </summary>
+    /// <param name="filename">file to create</param>
+    /// <param name="size">size of the file</param>
+    mapped_output_file(const std::string& filename, size_t size)
+    {
+#if defined(_WIN32)
+        file_handle = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_handle == INVALID_HANDLE_VALUE)
+        {
+            return;
+        }
+
+        // an empty file cannot be mapped, but it is still a valid (empty) output
+        if (size == 0)
+        {
+            opened = true;
+            return;
+        }
+
+        // a mapping larger than the file extends the file to the mapping's size
+        const uint64_t large_size = size;
+        mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READWRITE, static_cast<DWORD>(large_size >> 32), static_cast<DWORD>(large_size), nullptr);
+        if (mapping_handle != nullptr)
+        {
+            mapped_data = static_cast<char*>(MapViewOfFile(mapping_handle, FILE_MAP_WRITE, 0, 0, size));
+        }
+#else
+        fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        if (size == 0)
+        {
+            opened = true;
+            return;
+        }
+
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+        {
+            return;
+        }
+#if defined(__linux__)
+        // ftruncate leaves a hole, and a store into a hole the disk has no room for is a SIGBUS rather than an error.
+        // reserve the blocks up front, a filesystem that cannot do it cheaply keeps the hole, any other failure (a full
+        // disk, a quota) leaves the file unmapped so the caller writes it the ordinary way and gets an ordinary error
+        if (fallocate(fd, 0, 0, static_cast<off_t>(size)) != 0 && errno != EOPNOTSUPP && errno != ENOSYS)
+        {
+            return;
+        }
+#endif
+
+        void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (address != MAP_FAILED)
+        {
+            mapped_data = static_cast<char*>(address);
+            // the file is filled front to back once
+            madvise(address, size, MADV_SEQUENTIAL);
+        }
+#endif
+
+        if (mapped_data != nullptr)
+        {
+            mapped_size = size;
+            opened = true;
+        }
+    }
+
+    ~mapped_output_file()
+    {
+        close();
+    }
+
+    mapped_output_file(const mapped_output_file&) = delete;
+    mapped_output_file& operator=(const mapped_output_file&) = delete;
+
+    /// <summary>
+    /// true when the file was created, sized and mapped
+    /// </summary>
+    bool is_open() const
+    {
+        return opened;
+    }
+
+    /// <summary>
+    /// the mapped file, valid until close
+    /// </summary>
+    std::span<char> data() const
+    {
+        return std::span<char>(mapped_data, mapped_size);
+    }
+
+    /// <summary>
+    /// write the mapping back, unmap it and close the file. the writeback is waited for, a store into a mapping has no
+    /// other way to report an io error
+    /// </summary>
+    /// <returns>false if the file was not open or was not written back and closed cleanly</returns>
+    bool close()
+    {
+        bool ok = opened;
+#if defined(_WIN32)
+        if (mapped_data != nullptr)
+        {
+            ok = FlushViewOfFile(mapped_data, 0) && FlushFileBuffers(file_handle) && ok;
+            UnmapViewOfFile(mapped_data);
+        }
+        if (mapping_handle != nullptr)
+        {
+            CloseHandle(mapping_handle);
+        }
+        if (file_handle != INVALID_HANDLE_VALUE)
+        {
+            ok = CloseHandle(file_handle) && ok;
+        }
+        mapping_handle = nullptr;
+        file_handle = INVALID_HANDLE_VALUE;
+#else
+        if (mapped_data != nullptr)
+        {
+            ok = msync(mapped_data, mapped_size, MS_SYNC) == 0 && ok;
+            munmap(mapped_data, mapped_size);
+        }
+        if (fd >= 0)
+        {
+            ok = ::close(fd) == 0 && ok;
+        }
+        fd = -1;
+#endif
+        mapped_data = nullptr;
+        mapped_size = 0;
+        opened = false;
+        return ok;
+    }
+
+private:
+    char* mapped_data = nullptr;
+    size_t mapped_size = 0;
+    bool opened = false;
+#if defined(_WIN32)
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+/// <summary>
+/// write a data file the way save_data_file does, except the data is transformed by the pool straight from source into a mapping
+/// of the output, so it never exists in a buffer of ours
+/// </summary>
+/// <param name="filename">file to write</param>
+/// <param name="student_name">line 1</param>
+/// <param name="key">line 3, the key pattern was built from</param>
+/// <param name="source">bytes to transform into line 4 onward</param>
+/// <param name="pattern">pattern built from key by make_key_pattern</param>
+/// <param name="pool">threads to transform with</param>
+/// <param name="chunk_size">bytes each thread transforms at a time</param>
+/// <returns>false if the output could not be mapped or was not written back, the caller should write it the ordinary way</returns>
+bool save_data_file_mapped(const std::string& filename, const std::string& student_name, const std::string& key, std::span<const char> source,
+    const key_pattern& pattern, thread_pool& pool, size_t chunk_size)
+{
+    ENCRYPTION_STAGE(save_data_file, source.size());
+
+    const std::string header = format_data_file_header(student_name, key);
+
+    mapped_output_file output_file(filename, header.length() + source.size());
+    if (!output_file.is_open()) {
+        return false;
+    }
+
+    const auto output = output_file.data();
+    std::memcpy(output.data(), header.data(), header.length());
+    encrypt_decrypt_parallel(source, output.subspan(header.length()), pattern, pool, chunk_size);
+
+    // a failed writeback is retried through the write path, which reports the error if it fails there too
+    return output_file.close();
+}
+
+
+// size of the blocks the streaming mode reads, transforms and writes
+constexpr size_t default_block_size = size_t(1) << 20;
+
+/// <summary>
+/// write the three header lines save_data_file puts in front of the data
+/// </summary>
+/// <param name="output_file">stream to write to</param>
+/// <param name="student_name">line 1</param>
+/// <param name="key">line 3</param>
+void write_data_file_header(std::ostream& output_file, const std::string& student_name, const std::string& key)
+{
+    char time_buf[80];
+    format_current_date(time_buf, sizeof(time_buf));
+
+    output_file << student_name << "\n" << time_buf << "\n" << key << "\n";
+}
+
+/// <summary>
+/// transform input into output one block at a time, carrying the key phase from each block into the next
+/// </summary>
+/// <param name="input">stream to read from, read until end of file</param>
+/// <param name="output">stream to write the transformed bytes to</param>
+/// <param name="pattern">pattern built from the key by make_key_pattern</param>
+/// <param name="buffer">block buffer, its size is the block size</param>
+/// <param name="key_offset">key index lined up with the first byte read</param>
+/// <returns>number of bytes transformed</returns>
+uint64_t encrypt_decrypt_stream(std::istream& input, std::ostream& output, const key_pattern& pattern, std::span<char> buffer, uint64_t key_offset = 0)
+{
+    uint64_t total = 0;
+
+    while (input && output)
+    {
+        input.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        const auto count = static_cast<size_t>(input.gcount());
+        if (count == 0)
+        {
+            break;
+        }
+
+        // transform in place and hand the block straight back out, the phase keeps counting from the previous block
+        const auto block = buffer.first(count);
+        encrypt_decrypt(block, block, pattern, static_cast<size_t>((key_offset + total) % pattern.key_length));
+        output.write(block.data(), static_cast<std::streamsize>(count));
+        total += count;
+    }
+
+    return total;
+}
+
+// bytes an encrypting or decrypting streambuf holds between calls to the streambuf it wraps
+constexpr size_t default_streambuf_size = size_t(64) << 10;
+
+/// <summary>
+/// output streambuf that encrypts (or decrypts, it is the same xor) everything written to it and passes it on to another
+/// streambuf. the buffer is allocated once, every write after that is transformed straight into it at the running key phase
+/// </summary>
+class encrypting_streambuf : public std::streambuf
+{
+public:
+    /// <summary>
+    /// wrap downstream, which must outlive this object
+    /// </summary>
+    /// <param name="downstream">streambuf the transformed bytes are written to</param>
+    /// <param name="pattern">pattern built from the key by make_key_pattern</param>
+    /// <param name="buffer_size">bytes collected before each write to downstream</param>
+    /// <param name="key_offset">key index lined up with the first byte written</param>
+    encrypting_streambuf(std::streambuf& downstream, const key_pattern& pattern, size_t buffer_size = default_streambuf_size, uint64_t key_offset = 0)
+        : downstream(downstream), pattern(pattern), buffer(std::max<size_t>(buffer_size, 1)), position(key_offset)
+    {
+        setp(buffer.data(), buffer.data() + buffer.size());
+        transformed = pbase();
+    }
+
+    ~encrypting_streambuf() override
+    {
+        flush_buffer();
+    }
+
+    encrypting_streambuf(const encrypting_streambuf&) = delete;
+    encrypting_streambuf& operator=(const encrypting_streambuf&) = delete;
+
+protected:
+    int_type overflow(int_type character) override
+    {
+        if (!flush_buffer())
+        {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(character, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(character);
+            pbump(1);
+        }
+        return traits_type::not_eof(character);
+    }
+
+    std::streamsize xsputn(const char* source, std::streamsize count) override
+    {
+        // single characters put with sputc are still waiting, they come first in the key phase
+        transform_pending();
+
+        std::streamsize done = 0;
+        while (done < count)
+        {
+            if (pptr() == epptr() && !flush_buffer())
+            {
+                break;
+            }
+            // copy and transform in the same pass, the caller's bytes go straight into the buffer already encrypted
+            const size_t length = static_cast<size_t>(std::min<std::streamsize>(count - done, epptr() - pptr()));
+            encrypt_decrypt(std::span<const char>(source + done, length), std::span<char>(pptr(), length), pattern, phase_of(pptr()));
+            pbump(static_cast<int>(length));
+            transformed = pptr();
+            done += static_cast<std::streamsize>(length);
+        }
+        return done;
+    }
+
+    int sync() override
+    {
+        return flush_buffer() && downstream.pubsync() != -1 ? 0 : -1;
+    }
+
+private:
+    /// <summary>
+    /// key index for a byte in the buffer
+    /// </summary>
+    size_t phase_of(const char* byte) const
+    {
+        return static_cast<size_t>((position + static_cast<uint64_t>(byte - pbase())) % pattern.key_length);
+    }
+
+    /// <summary>
+    /// transform whatever sputc has put in the buffer since the last transform
+    /// </summary>
+    void transform_pending()
+    {
+        const auto pending = std::span<char>(transformed, pptr());
+        encrypt_decrypt(pending, pending, pattern, phase_of(transformed));
+        transformed = pptr();
+    }
+
+    /// <summary>
+    /// transform what is left in the buffer and write all of it downstream
+    /// </summary>
+    /// <returns>false if downstream did not take every byte</returns>
+    bool flush_buffer()
+    {
+        transform_pending();
+        const std::streamsize length = pptr() - pbase();
+        const bool written = downstream.sputn(pbase(), length) == length;
+        position += static_cast<uint64_t>(length);
+        setp(buffer.data(), buffer.data() + buffer.size());
+        transformed = pbase();
+        return written;
+    }
+
+    std::streambuf& downstream;
+    const key_pattern pattern;
+    std::vector<char> buffer;
+    // stream position of the start of the buffer
+    uint64_t position = 0;
+    // end of the bytes in the buffer that are already transformed
+    char* transformed = nullptr;
+};
+
+/// <summary>
+/// input streambuf that decrypts (or encrypts) everything read from another streambuf. reads at least as large as the buffer
+/// go straight into the caller's memory and are transformed there, smaller ones are served from the buffer allocated up front
+/// </summary>
+class decrypting_streambuf : public std::streambuf
+{
+public:
+    /// <summary>
+    /// wrap upstream, which must outlive this object
+    /// </summary>
+    /// <param name="upstream">streambuf the transformed bytes are read from</param>
+    /// <param name="pattern">pattern built from the key by make_key_pattern</param>
+    /// <param name="buffer_size">bytes read from upstream at a time</param>
+    /// <param name="key_offset">key index lined up with the first byte read</param>
+    decrypting_streambuf(std::streambuf& upstream, const key_pattern& pattern, size_t buffer_size = default_streambuf_size, uint64_t key_offset = 0)
+        : upstream(upstream), pattern(pattern), buffer(std::max<size_t>(buffer_size, 1)), position(key_offset)
+    {
+        setg(buffer.data(), buffer.data(), buffer.data());
+    }
+
+    decrypting_streambuf(const decrypting_streambuf&) = delete;
+    decrypting_streambuf& operator=(const decrypting_streambuf&) = delete;
+
+protected:
+    int_type underflow() override
+    {
+        const std::streamsize length = upstream.sgetn(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        if (length <= 0)
+        {
+            return traits_type::eof();
+        }
+        transform_read(std::span<char>(buffer.data(), static_cast<size_t>(length)));
+        setg(buffer.data(), buffer.data(), buffer.data() + length);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize xsgetn(char* destination, std::streamsize count) override
+    {
+        // hand out what is already decrypted in the buffer first
+        std::streamsize done = std::min<std::streamsize>(count, egptr() - gptr());
+        std::memcpy(destination, gptr(), static_cast<size_t>(done));
+        gbump(static_cast<int>(done));
+
+        while (done < count)
+        {
+            const std::streamsize remaining = count - done;
+            if (remaining < static_cast<std::streamsize>(buffer.size()))
+            {
+                // a small read, fill the buffer so the bytes after it are ready for the next one
+                if (traits_type::eq_int_type(underflow(), traits_type::eof()))
+                {
+                    break;
+                }
+                const std::streamsize length = std::min<std::streamsize>(remaining, egptr() - gptr());
+                std::memcpy(destination + done, gptr(), static_cast<size_t>(length));
+                gbump(static_cast<int>(length));
+                done += length;
+                continue;
+            }
+
+            const std::streamsize length = upstream.sgetn(destination + done, remaining);
+            if (length <= 0)
+            {
+                break;
+            }
+            transform_read(std::span<char>(destination + done, static_cast<size_t>(length)));
+            done += length;
+        }
+        return done;
+    }
+
+private:
+    /// <summary>
+    /// transform bytes just read from upstream in place and move the key phase past them
+    /// </summary>
+    void transform_read(std::span<char> bytes)
+    {
+        encrypt_decrypt(bytes, bytes, pattern, static_cast<size_t>(position % pattern.key_length));
+        position += bytes.size();
+    }
+
+    std::streambuf& upstream;
+    const key_pattern pattern;
+    std::vector<char> buffer;
+    // stream position of the next byte read from upstream
+    uint64_t position = 0;
+};
+
+/// <summary>
+/// read the student name from the start of an input and leave the stream on the first byte to transform
+/// </summary>
+/// <param name="input_file">binary stream positioned at the start of the file</param>
+/// <param name="input_has_header">true when the input was written by save_data_file, its date and key lines are skipped too</param>
+/// <returns>the student name</returns>
+std::string read_data_file_prefix(std::istream& input_file, bool input_has_header)
+{
+    // line 1 is the name, for a data file the date and key lines are then rewritten for the new file
+    std::string student_name;
+    std::getline(input_file, student_name);
+    if (input_file.eof()) {
+        // no newline at all, the same as get_student_name
+        student_name.clear();
+    }
+    if (!student_name.empty() && student_name.back() == '\r') {
+        student_name.pop_back();
+    }
+    if (input_has_header) {
+        std::string line;
+        std::getline(input_file, line);
+        std::getline(input_file, line);
+    }
+    else {
+        // the name line is part of the data, so go back and transform it too
+        input_file.clear();
+        input_file.seekg(0);
+    }
+    return student_name;
+}
+
+/// <summary>
+/// encrypt or decrypt a file into the save_data_file format without ever holding the whole file in memory
+/// </summary>
+/// <param name="input_filename">file to read</param>
+/// <param name="output_filename">file to write, header then transformed data</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="block_size">bytes held in memory at once</param>
+/// <param name="input_has_header">true when the input was itself written by save_data_file, its header is replaced rather than transformed</param>
+/// <returns>true if the whole file was transformed and written</returns>
+bool stream_data_file(const std::string& input_filename, const std::string& output_filename, const std::string& key, size_t block_size, bool input_has_header)
+{
+    assert(block_size > 0);
+
+    try {
+        // binary both ways, a text mode stream would rewrite newline bytes inside the encrypted data
+        std::ifstream input_file(input_filename, std::ios::binary);
+        if (!input_file) {
+            std::cout << "Could not read file." << std::endl;
+            return false;
+        }
+
+        const std::string student_name = read_data_file_prefix(input_file, input_has_header);
+
+        std::ofstream output_file(output_filename, std::ios::binary);
+        write_data_file_header(output_file, student_name, key);
+
+        std::vector<char> buffer(block_size);
+        encrypt_decrypt_stream(input_file, output_file, make_key_pattern(key), buffer);
+
+        output_file.close();
+        if (!output_file || input_file.bad()) {
+            std::cout << "Could not write to file." << std::endl;
+            return false;
+        }
+        return true;
+    }
+    catch (...) {
+        std::cout << "Could not write to file." << std::endl;
+    }
+    return false;
+}
+
+/// <summary>
+/// fill a buffer from standard input, a pipe hands back whatever is ready so this keeps reading until the buffer is full
+/// </summary>
+/// <param name="buffer">buffer to fill</param>
+/// <param name="count">bytes read, less than the buffer only at end of input</param>
+/// <returns>false on a read error</returns>
+bool read_standard_input(std::span<char> buffer, size_t& count)
+{
+    count = 0;
+#if defined(_WIN32)
+    count = std::fread(buffer.data(), 1, buffer.size(), stdin);
+    return !std::ferror(stdin);
+#else
+    while (count < buffer.size())
+    {
+        const ssize_t result = read(STDIN_FILENO, buffer.data() + count, buffer.size() - count);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result < 0)
+        {
+            return false;
+        }
+        if (result == 0)
+        {
+            break;
+        }
+        count += static_cast<size_t>(result);
+    }
+    return true;
+#endif
+}
+
+/// <summary>
+/// writes blocks to standard output. when that is a pipe on linux the blocks are vmspliced, the pipe takes references to our
+/// pages instead of copying them. a reader that splices onward (tee, or splice to a file) keeps those references for as long
+/// as it likes, so a page is never written again once it has been handed over: every block gets freshly mapped pages, they
+/// are gifted to the pipe and unmapped on our side
+/// </summary>
+class standard_output_writer
+{
+public:
+    /// <param name="block_size">bytes per buffer</param>
+    explicit standard_output_writer(size_t block_size)
+        : block_size(block_size)
+    {
+#if defined(_WIN32)
+        _setmode(_fileno(stdout), _O_BINARY);
+#elif defined(__linux__)
+        struct stat output_stat;
+        if (fstat(STDOUT_FILENO, &output_stat) == 0 && S_ISFIFO(output_stat.st_mode)) {
+            // a bigger pipe means fewer wakeups, the limit in /proc/sys/fs/pipe-max-size may refuse it
+            fcntl(STDOUT_FILENO, F_SETPIPE_SZ, static_cast<int>(std::min<size_t>(block_size, INT_MAX)));
+            zero_copy = map_block();
+        }
+#endif
+        if (!zero_copy) {
+            storage.resize(block_size);
+            current = storage.data();
+        }
+    }
+
+    ~standard_output_writer()
+    {
+#if defined(__linux__)
+        if (zero_copy && current != nullptr) {
+            munmap(current, mapped_size());
+        }
+#endif
+    }
+
+    standard_output_writer(const standard_output_writer&) = delete;
+    standard_output_writer& operator=(const standard_output_writer&) = delete;
+
+    /// <summary>
+    /// the buffer to fill for the next write
+    /// </summary>
+    std::span<char> buffer()
+    {
+        return std::span<char>(current, block_size);
+    }
+
+    /// <summary>
+    /// true if blocks go out with vmsplice
+    /// </summary>
+    bool is_zero_copy() const
+    {
+        return zero_copy;
+    }
+
+    /// <summary>
+    /// copy bytes out, for the header lines
+    /// </summary>
+    bool write_copy(std::string_view bytes)
+    {
+#if defined(_WIN32)
+        return std::fwrite(bytes.data(), 1, bytes.length(), stdout) == bytes.length();
+#else
+        struct iovec buffer = { const_cast<char*>(bytes.data()), bytes.length() };
+        return write_all_vectored(STDOUT_FILENO, &buffer, 1);
+#endif
+    }
+
+    /// <summary>
+    /// send part of the current buffer, after which buffer() is a different one
+    /// </summary>
+    /// <param name="begin">first byte of the buffer to send</param>
+    /// <param name="count">bytes to send</param>
+    bool write(size_t begin, size_t count)
+    {
+        const char* data = current + begin;
+#if defined(__linux__)
+        if (zero_copy) {
+            struct iovec pages = { const_cast<char*>(data), count };
+            bool ok = true;
+            while (pages.iov_len > 0) {
+                const ssize_t spliced = vmsplice(STDOUT_FILENO, &pages, 1, SPLICE_F_GIFT);
+                if (spliced < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (spliced < 0) {
+                    ok = false;
+                    break;
+                }
+                pages.iov_base = static_cast<char*>(pages.iov_base) + spliced;
+                pages.iov_len -= static_cast<size_t>(spliced);
+            }
+            // the pipe holds its own references to the pages, dropping ours means nothing can write to them again
+            munmap(current, mapped_size());
+            current = nullptr;
+            return map_block() && ok;
+        }
+#endif
+        return write_copy(std::string_view(data, count));
+    }
+
+    /// <summary>
+    /// push out anything buffered
+    /// </summary>
+    bool flush()
+    {
+#if defined(_WIN32)
+        return std::fflush(stdout) == 0;
+#else
+        return true;
+#endif
+    }
+
+private:
+    static constexpr size_t page_size = 4096;
+
+    /// <summary>
+    /// a block rounded up to whole pages, only whole pages can be gifted
+    /// </summary>
+    size_t mapped_size() const
+    {
+        return (block_size + page_size - 1) / page_size * page_size;
+    }
+
+#if defined(__linux__)
+    /// <summary>
+    /// map fresh pages for the next block, populated up front so filling them does not fault page by page
+    /// </summary>
+    bool map_block()
+    {
+        void* address = mmap(nullptr, mapped_size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        current = address == MAP_FAILED ? nullptr : static_cast<char*>(address);
+        return current != nullptr;
+    }
+#endif
+
+    size_t block_size;
+    std::vector<char> storage;
+    char* current = nullptr;
+    bool zero_copy = false;
+};
+
+/// <summary>
+/// encrypt standard input to standard output in the save_data_file format, or decrypt such a stream back to the raw data.
+/// the header lines go out once, the key phase carries from block to block. all messages go to standard error
+/// </summary>
+/// <param name="decrypt">true to read a data file and write the raw data, false to write a data file</param>
+/// <param name="key">key to encrypt with, for decrypting empty means the key on the header's third line</param>
+/// <param name="student_name">name for the header, empty to take the first line of the input as the file modes do</param>
+/// <param name="block_size">bytes per read and write</param>
+/// <returns>true if all of standard input was transformed and written</returns>
+bool pipe_data_stream(bool decrypt, const std::string& key, const std::string& student_name, size_t block_size)
+{
+    assert(block_size > 0);
+#if defined(_WIN32)
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    standard_output_writer output(block_size);
+
+    size_t count = 0;
+    if (!read_standard_input(output.buffer(), count)) {
+        std::cerr << "Could not read file." << std::endl;
+        return false;
+    }
+
+    // the first block carries the header, either written in front of it or found at its start
+    std::string_view first_block(output.buffer().data(), count);
+    size_t data_begin = 0;
+    key_pattern pattern;
+    if (decrypt) {
+        std::string name;
+        std::string_view data;
+        if (!split_data_file(first_block, name, data)) {
+            std::cerr << "Not a data file: the header must fit in the first block" << std::endl;
+            return false;
+        }
+        data_begin = count - data.length();
+        const size_t key_line = first_block.find('\n', first_block.find('\n') + 1) + 1;
+        pattern = make_key_pattern(resolve_cipher_key(key, get_student_name(first_block.substr(key_line))));
+    }
+    else {
+        pattern = make_key_pattern(key);
+        char time_buf[80];
+        const size_t date_length = format_current_date(time_buf, sizeof(time_buf));
+        const std::string header = (student_name.empty() ? get_student_name(first_block) : student_name) + "\n"
+            + std::string(time_buf, date_length) + "\n" + key + "\n";
+        if (!output.write_copy(header)) {
+            std::cerr << "Could not write to file." << std::endl;
+            return false;
+        }
+    }
+
+    uint64_t total = 0;
+    while (count > 0)
+    {
+        const auto block = output.buffer().subspan(data_begin, count - data_begin);
+        encrypt_decrypt(block, block, pattern, static_cast<size_t>(total % pattern.key_length));
+        total += block.size();
+        if (!output.write(data_begin, block.size())) {
+            std::cerr << "Could not write to file." << std::endl;
+            return false;
+        }
+
+        // a short block means the input has ended
+        if (count < block_size) {
+            break;
+        }
+        data_begin = 0;
+        if (!read_standard_input(output.buffer(), count)) {
+            std::cerr << "Could not read file." << std::endl;
+            return false;
+        }
+    }
+    return output.flush();
+}
+
+/// <summary>
+/// the three header lines save_data_file writes, and where the data after them starts
+/// </summary>
+struct data_file_header
+{
+    std::string student_name;
+    std::string date;
+    std::string key;
+    uint64_t data_offset = 0;
+};
+
+// binary container format (v2), all integers little endian:
+//   0  magic "AENCDAT2"           8 bytes
+//   8  version (2)                u32
+//  12  header size                u32  fixed part + strings + chunk table
+//  16  payload offset             u64  header size rounded up to a page so chunks can be mapped
+//  24  payload length             u64
+//  32  chunk size                 u32
+//  36  reserved (0)               u32
+//  40  chunk count                u64
+//  48  name, date, key lengths    3 x u32
+//  60  header crc32c              u32  over the header size bytes with this field zeroed
+//  64  name, date and key bytes, then one 16 byte entry per chunk: file offset u64, length u32, crc32c u32
+// the payload is the transformed data, the chunk crcs are of the transformed bytes so a file can be checked without the key
+constexpr char data_file_v2_magic[8] = { 'A', 'E', 'N', 'C', 'D', 'A', 'T', '2' };
+constexpr uint32_t data_file_v2_version = 2;
+constexpr size_t data_file_v2_fixed_size = 64;
+constexpr size_t data_file_v2_chunk_entry_size = 16;
+constexpr size_t data_file_v2_alignment = 4096;
+constexpr size_t default_container_chunk_size = size_t(1) << 20;
+// the incremental mode rewrites whole chunks, so its default is a page: a small edit writes kilobytes, not a megabyte
+constexpr size_t default_incremental_chunk_size = size_t(4) << 10;
+
+/// <summary>
+/// one entry of the v2 chunk table
+/// </summary>
+struct data_file_v2_chunk
+{
+    uint64_t offset = 0;
+    uint32_t length = 0;
+    uint32_t checksum = 0;
+};
+
+/// <summary>
+/// everything in a v2 header
+/// </summary>
+struct data_file_v2_layout
+{
+    data_file_header header;
+    uint64_t data_size = 0;
+    uint32_t chunk_size = 0;
+    std::vector<data_file_v2_chunk> chunks;
+};
+
+inline void put_u32(char* out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        out[i] = static_cast<char>(value >> (8 * i));
+    }
+}
+
+inline void put_u64(char* out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        out[i] = static_cast<char>(value >> (8 * i));
+    }
+}
+
+inline uint32_t get_u32(const char* in)
+{
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; --i)
+    {
+        value = (value << 8) | static_cast<unsigned char>(in[i]);
+    }
+    return value;
+}
+
+inline uint64_t get_u64(const char* in)
+{
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i)
+    {
+        value = (value << 8) | static_cast<unsigned char>(in[i]);
+    }
+    return value;
+}
+
+/// <summary>
+/// true if the bytes start with the v2 magic
+/// </summary>
+bool is_data_file_v2(std::string_view file_start)
+{
+    return file_start.length() >= sizeof(data_file_v2_magic) && std::memcmp(file_start.data(), data_file_v2_magic, sizeof(data_file_v2_magic)) == 0;
+}
+
+/// <summary>
+/// true when a v2 header size read from a file could be genuine, checked before anything is allocated for it
+/// </summary>
+/// <param name="header_size">header size field of the fixed header</param>
+/// <param name="file_size">size of the whole file</param>
+bool is_valid_v2_header_size(uint64_t header_size, uint64_t file_size)
+{
+    return header_size >= data_file_v2_fixed_size && header_size <= file_size;
+}
+
+/// <summary>
+/// parse and validate a v2 header
+/// </summary>
+/// <param name="header_bytes">the start of the file, at least the header size long</param>
+/// <param name="file_size">size of the whole file, every chunk must lie inside it</param>
+/// <param name="layout">the parsed header</param>
+/// <returns>false if this is not a well formed v2 file</returns>
+bool parse_data_file_v2(std::string_view header_bytes, uint64_t file_size, data_file_v2_layout& layout)
+{
+    if (header_bytes.length() < data_file_v2_fixed_size || !is_data_file_v2(header_bytes))
+    {
+        return false;
+    }
+    const char* in = header_bytes.data();
+    const uint32_t header_size = get_u32(in + 12);
+    const uint64_t chunk_count = get_u64(in + 40);
+    const uint64_t strings_size = uint64_t(get_u32(in + 48)) + get_u32(in + 52) + get_u32(in + 56);
+    if (get_u32(in + 8) != data_file_v2_version || !is_valid_v2_header_size(header_size, file_size) || header_size > header_bytes.length()
+        || data_file_v2_fixed_size + strings_size > header_size)
+    {
+        return false;
+    }
+    // bound the chunk count by the room left in the header before multiplying, a huge count must not wrap the product
+    if (chunk_count > (header_size - data_file_v2_fixed_size - strings_size) / data_file_v2_chunk_entry_size
+        || data_file_v2_fixed_size + strings_size + chunk_count * data_file_v2_chunk_entry_size != header_size)
+    {
+        return false;
+    }
+
+    // the crc covers the header with its own field zeroed
+    std::string checked(header_bytes.substr(0, header_size));
+    put_u32(&checked[60], 0);
+    if (crc32c_update(0, checked.data(), checked.length()) != get_u32(in + 60))
+    {
+        return false;
+    }
+
+    layout.header.data_offset = get_u64(in + 16);
+    layout.data_size = get_u64(in + 24);
+    layout.chunk_size = get_u32(in + 32);
+    if (layout.header.data_offset < header_size || layout.header.data_offset > file_size || layout.data_size > file_size - layout.header.data_offset)
+    {
+        return false;
+    }
+    // every chunk but the last is chunk_size long, so the count follows from the payload length
+    const uint64_t expected_chunks = layout.chunk_size == 0 ? 0 : (layout.data_size + layout.chunk_size - 1) / layout.chunk_size;
+    if ((layout.chunk_size == 0 && layout.data_size != 0) || chunk_count != expected_chunks)
+    {
+        return false;
+    }
+
+    size_t position = data_file_v2_fixed_size;
+    layout.header.student_name.assign(in + position, get_u32(in + 48));
+    position += get_u32(in + 48);
+    layout.header.date.assign(in + position, get_u32(in + 52));
+    position += get_u32(in + 52);
+    layout.header.key.assign(in + position, get_u32(in + 56));
+    position += get_u32(in + 56);
+
+    layout.chunks.resize(static_cast<size_t>(chunk_count));
+    uint64_t expected_offset = layout.header.data_offset;
+    for (auto& chunk : layout.chunks)
+    {
+        chunk.offset = get_u64(in + position);
+        chunk.length = get_u32(in + position + 8);
+        chunk.checksum = get_u32(in + position + 12);
+        position += data_file_v2_chunk_entry_size;
+
+        // chunks tile the payload in order
+        if (chunk.offset != expected_offset)
+        {
+            return false;
+        }
+        expected_offset += chunk.length;
+    }
+    return expected_offset == layout.header.data_offset + layout.data_size;
+}
+
+/// <summary>
+/// save already transformed data in the v2 container: fixed header, lengths, and a chunk table with a crc32c per chunk
+/// </summary>
+/// <param name="filename">file to write</param>
+/// <param name="student_name">stored in the header</param>
+/// <param name="key">stored in the header, as the text format stores it on line 3</param>
+/// <param name="data">transformed data</param>
+/// <param name="chunk_size">bytes per chunk</param>
+/// <param name="chunk_checksums">crc32c of each chunk if the caller already has them from encrypt_decrypt_checksummed, empty to compute them here</param>
+/// <returns>true if the file was written</returns>
+bool save_data_file_v2(const std::string& filename, const std::string& student_name, const std::string& key, std::string_view data, size_t chunk_size,
+    std::span<const uint32_t> chunk_checksums = {})
+{
+    ENCRYPTION_STAGE(save_data_file, data.length());
+    assert(chunk_size > 0 && chunk_size <= UINT32_MAX);
+
+    char time_buf[80];
+    const size_t date_length = format_current_date(time_buf, sizeof(time_buf));
+
+    const uint64_t chunk_count = (data.length() + chunk_size - 1) / chunk_size;
+    assert(chunk_checksums.empty() || chunk_checksums.size() == chunk_count);
+    const size_t header_size = data_file_v2_fixed_size + student_name.length() + date_length + key.length()
+        + static_cast<size_t>(chunk_count) * data_file_v2_chunk_entry_size;
+    const uint64_t payload_offset = (header_size + data_file_v2_alignment - 1) / data_file_v2_alignment * data_file_v2_alignment;
+
+    // header, strings, chunk table and the zero padding up to the payload
+    std::string header(static_cast<size_t>(payload_offset), '\0');
+    char* out = &header[0];
+    std::memcpy(out, data_file_v2_magic, sizeof(data_file_v2_magic));
+    put_u32(out + 8, data_file_v2_version);
+    put_u32(out + 12, static_cast<uint32_t>(header_size));
+    put_u64(out + 16, payload_offset);
+    put_u64(out + 24, data.length());
+    put_u32(out + 32, static_cast<uint32_t>(chunk_size));
+    put_u64(out + 40, chunk_count);
+    put_u32(out + 48, static_cast<uint32_t>(student_name.length()));
+    put_u32(out + 52, static_cast<uint32_t>(date_length));
+    put_u32(out + 56, static_cast<uint32_t>(key.length()));
+
+    size_t position = data_file_v2_fixed_size;
+    for (const auto& text : { std::string_view(student_name), std::string_view(time_buf, date_length), std::string_view(key) })
+    {
+        std::memcpy(out + position, text.data(), text.length());
+        position += text.length();
+    }
+    for (uint64_t chunk = 0; chunk < chunk_count; ++chunk)
+    {
+        const size_t begin = static_cast<size_t>(chunk * chunk_size);
+        const size_t length = std::min(chunk_size, data.length() - begin);
+        put_u64(out + position, payload_offset + begin);
+        put_u32(out + position + 8, static_cast<uint32_t>(length));
+        put_u32(out + position + 12, chunk_checksums.empty() ? crc32c_update(0, data.data() + begin, length) : chunk_checksums[static_cast<size_t>(chunk)]);
+        position += data_file_v2_chunk_entry_size;
+    }
+    put_u32(out + 60, crc32c_update(0, header.data(), header_size));
+
+    std::ofstream output_file(filename, std::ios::binary);
+    output_file.write(header.data(), static_cast<std::streamsize>(header.length()));
+    output_file.write(data.data(), static_cast<std::streamsize>(data.length()));
+    output_file.close();
+    if (!output_file) {
+        std::cout << "Could not write to file." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// decrypt every chunk of a mapped v2 file and check it against its crc in the same pass, each chunk on its own so they run in parallel
+/// </summary>
+/// <param name="file_data">the whole mapped file</param>
+/// <param name="layout">its parsed header</param>
+/// <param name="pattern">pattern built from the key by make_key_pattern</param>
+/// <param name="destination">receives the decrypted payload, layout.data_size bytes</param>
+/// <param name="pool">threads to run on</param>
+/// <returns>index of the first chunk that failed its crc, or the chunk count if they all passed</returns>
+size_t decrypt_data_file_v2(std::string_view file_data, const data_file_v2_layout& layout, const key_pattern& pattern, std::span<char> destination, thread_pool& pool)
+{
+    assert(destination.size() == layout.data_size);
+
+    std::atomic<size_t> first_bad{ layout.chunks.size() };
+    pool.parallel_for(layout.chunks.size(), [&](size_t index)
+    {
+        const auto& chunk = layout.chunks[index];
+        const uint64_t data_offset = chunk.offset - layout.header.data_offset;
+        const uint32_t checksum = encrypt_decrypt_checksummed(std::span<const char>(file_data.data() + chunk.offset, chunk.length),
+            destination.subspan(static_cast<size_t>(data_offset), chunk.length), pattern, static_cast<size_t>(data_offset % pattern.key_length), 0, true);
+        if (checksum != chunk.checksum)
+        {
+            size_t expected = first_bad.load();
+            while (index < expected && !first_bad.compare_exchange_weak(expected, index))
+            {
+            }
+        }
+    });
+    return first_bad.load();
+}
+
+/// <summary>
+/// find the header and the encrypted data of a file in either format without transforming anything
+/// </summary>
+/// <param name="file_data">the whole file</param>
+/// <param name="filename">name for the error messages</param>
+/// <param name="header">the file's header</param>
+/// <param name="data">the encrypted data, a view into file_data</param>
+/// <param name="layout">the chunk table of a v2 file, left empty for the text format</param>
+/// <returns>false if the file is malformed</returns>
+bool parse_data_file(std::string_view file_data, const std::string& filename, data_file_header& header, std::string_view& data, data_file_v2_layout& layout)
+{
+    if (is_data_file_v2(file_data)) {
+        if (file_data.length() < data_file_v2_fixed_size || !is_valid_v2_header_size(get_u32(file_data.data() + 12), file_data.length())
+            || !parse_data_file_v2(file_data, file_data.length(), layout)) {
+            std::cout << "Corrupt v2 header: " << filename << std::endl;
+            return false;
+        }
+        header = layout.header;
+        data = file_data.substr(static_cast<size_t>(header.data_offset), static_cast<size_t>(layout.data_size));
+        return true;
+    }
+
+    // the original text format: name, date and key lines, then the data
+    if (!split_data_file(file_data, header.student_name, data)) {
+        std::cout << "Not a data file: " << filename << std::endl;
+        return false;
+    }
+    header.data_offset = file_data.length() - data.length();
+    const size_t date_begin = file_data.find('\n') + 1;
+    header.date = get_student_name(file_data.substr(date_begin));
+    header.key = get_student_name(file_data.substr(file_data.find('\n', date_begin) + 1));
+    return true;
+}
+
+/// <summary>
+/// check every chunk of a v2 file against its crc without decrypting anything, for callers that decrypt the data themselves
+/// </summary>
+/// <returns>index of the first chunk that failed its crc, or the chunk count if they all passed</returns>
+size_t check_data_file_v2(std::string_view file_data, const data_file_v2_layout& layout)
+{
+    for (size_t index = 0; index < layout.chunks.size(); ++index) {
+        const auto& chunk = layout.chunks[index];
+        if (crc32c_update(0, file_data.data() + chunk.offset, chunk.length) != chunk.checksum) {
+            return index;
+        }
+    }
+    return layout.chunks.size();
+}
+
+/// <summary>
+/// open an encrypted file in either format, the v2 container or the original text header, and decrypt its data
+/// </summary>
+/// <param name="filename">file written by save_data_file or save_data_file_v2</param>
+/// <param name="key">key to decrypt with, empty to use the key stored in the file</param>
+/// <param name="pool">threads to decrypt v2 chunks on</param>
+/// <param name="header">the file's header</param>
+/// <param name="plain_text">the decrypted data</param>
+/// <returns>false if the file could not be read, is malformed, or a v2 chunk failed its crc</returns>
+bool load_data_file(const std::string& filename, const std::string& key, thread_pool& pool, data_file_header& header, std::string& plain_text)
+{
+    ENCRYPTION_STAGE(load_data_file, 0);
+    const mapped_file input_file(filename);
+    if (!input_file.is_open()) {
+        std::cout << "Could not read file." << std::endl;
+        return false;
+    }
+    const std::string_view file_data = input_file.view();
+    ENCRYPTION_STAGE_BYTES(load_data_file, file_data.length());
+
+    std::string_view data;
+    data_file_v2_layout layout;
+    if (!parse_data_file(file_data, filename, header, data, layout)) {
+        return false;
+    }
+
+    const auto pattern = make_key_pattern(resolve_cipher_key(key, header.key));
+    plain_text.resize(data.length());
+    if (is_data_file_v2(file_data)) {
+        // every chunk is decrypted and checked against its crc in the same pass
+        const size_t bad_chunk = decrypt_data_file_v2(file_data, layout, pattern, plain_text, pool);
+        if (bad_chunk != layout.chunks.size()) {
+            std::cout << "Checksum mismatch in chunk " << bad_chunk << " at offset " << layout.chunks[bad_chunk].offset << ": " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+    encrypt_decrypt_parallel(data, plain_text, pattern, pool);
+    return true;
+}
+
+/// <summary>
+/// random access to the plain text of a file written by save_data_file or save_data_file_v2. the cipher is positional, so any byte range
+/// decrypts on its own with the key phase taken from its offset, and nothing before the range has to be read
+/// </summary>
+class data_file_reader
+{
+public:
+    /// <summary>
+    /// open a data file and parse its header, check is_open to see if it worked
+    /// </summary>
+    /// <param name="filename">file written by save_data_file</param>
+    /// <param name="key">key to decrypt with, empty to use the key stored on line 3</param>
+    data_file_reader(const std::string& filename, const std::string& key = std::string())
+    {
+        std::ifstream input_file(filename, std::ios::binary);
+        if (!input_file) {
+            return;
+        }
+        input_file.seekg(0, std::ios::end);
+        const auto file_size = static_cast<uint64_t>(input_file.tellg());
+        input_file.seekg(0);
+
+        char fixed[data_file_v2_fixed_size];
+        input_file.read(fixed, sizeof(fixed));
+        const std::string_view file_start(fixed, static_cast<size_t>(input_file.gcount()));
+        input_file.clear();
+
+        if (is_data_file_v2(file_start) && file_start.length() == data_file_v2_fixed_size) {
+            // v2 header, the strings and the chunk table end at the header size. the size comes from the file, so it is
+            // checked against the file before anything that large is allocated
+            if (!is_valid_v2_header_size(get_u32(fixed + 12), file_size)) {
+                return;
+            }
+            std::string header_bytes(get_u32(fixed + 12), '\0');
+            input_file.seekg(0);
+            input_file.read(&header_bytes[0], static_cast<std::streamsize>(header_bytes.length()));
+            data_file_v2_layout layout;
+            if (!input_file || !parse_data_file_v2(header_bytes, file_size, layout)) {
+                return;
+            }
+            file_header = layout.header;
+            data_size = layout.data_size;
+        }
+        else {
+            input_file.seekg(0);
+            if (!std::getline(input_file, file_header.student_name) || !std::getline(input_file, file_header.date)
+                || !std::getline(input_file, file_header.key)) {
+                return;
+            }
+            file_header.data_offset = static_cast<uint64_t>(input_file.tellg());
+            for (auto* line : { &file_header.student_name, &file_header.date, &file_header.key }) {
+                if (!line->empty() && line->back() == '\r') {
+                    line->pop_back();
+                }
+            }
+            data_size = file_size > file_header.data_offset ? file_size - file_header.data_offset : 0;
+        }
+
+        const std::string cipher_key = resolve_cipher_key(key, file_header.key);
+        if (cipher_key.empty()) {
+            return;
+        }
+        pattern = make_key_pattern(cipher_key);
+
+#if defined(_WIN32)
+        input_file.seekg(0);
+        file_stream = std::move(input_file);
+#else
+        input_file.close();
+        fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+#endif
+        opened = true;
+    }
+
+    ~data_file_reader()
+    {
+#if !defined(_WIN32)
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
+    }
+
+    data_file_reader(const data_file_reader&) = delete;
+    data_file_reader& operator=(const data_file_reader&) = delete;
+
+    bool is_open() const
+    {
+        return opened;
+    }
+
+    const data_file_header& header() const
+    {
+        return file_header;
+    }
+
+    /// <summary>
+    /// bytes of data after the header
+    /// </summary>
+    uint64_t size() const
+    {
+        return data_size;
+    }
+
+    /// <summary>
+    /// decrypt data bytes [offset, offset + destination.size()) into destination, stopping early at the end of the data
+    /// </summary>
+    /// <param name="offset">offset into the data, not counting the header</param>
+    /// <param name="destination">receives the plain text</param>
+    /// <returns>number of bytes decrypted, less than asked for at the end of the data or on a read error</returns>
+    size_t read(uint64_t offset, std::span<char> destination)
+    {
+        if (!opened || offset >= data_size) {
+            return 0;
+        }
+        const size_t wanted = static_cast<size_t>(std::min<uint64_t>(destination.size(), data_size - offset));
+
+        size_t done = 0;
+#if defined(_WIN32)
+        file_stream.clear();
+        file_stream.seekg(static_cast<std::streamoff>(file_header.data_offset + offset));
+        file_stream.read(destination.data(), static_cast<std::streamsize>(wanted));
+        done = static_cast<size_t>(file_stream.gcount());
+#else
+        // pread leaves no shared file position behind, so one reader can serve several threads
+        while (done < wanted) {
+            const ssize_t count = pread(fd, destination.data() + done, wanted - done, static_cast<off_t>(file_header.data_offset + offset + done));
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                break;
+            }
+            done += static_cast<size_t>(count);
+        }
+#endif
+
+        const auto plain = destination.first(done);
+        encrypt_decrypt(plain, plain, pattern, static_cast<size_t>(offset % pattern.key_length));
+        return done;
+    }
+
+private:
+    data_file_header file_header;
+    key_pattern pattern;
+    uint64_t data_size = 0;
+    bool opened = false;
+#if defined(_WIN32)
+    std::ifstream file_stream;
+#else
+    int fd = -1;
+#endif
+};
+
+/// <summary>
+/// decrypt one byte range of a data file without reading the rest of it
+/// </summary>
+/// <param name="filename">file written by save_data_file</param>
+/// <param name="offset">offset into the data, not counting the header</param>
+/// <param name="length">bytes wanted, fewer are returned at the end of the data</param>
+/// <param name="key">key to decrypt with, empty to use the key stored in the file</param>
+/// <param name="plain_text">receives the decrypted bytes</param>
+/// <returns>false if the file could not be opened as a data file</returns>
+bool decrypt_range(const std::string& filename, uint64_t offset, size_t length, const std::string& key, std::string& plain_text)
+{
+    data_file_reader reader(filename, key);
+    if (!reader.is_open()) {
+        return false;
+    }
+    plain_text.resize(static_cast<size_t>(std::min<uint64_t>(length, offset < reader.size() ? reader.size() - offset : 0)));
+    plain_text.resize(reader.read(offset, plain_text));
+    return true;
+}
+
+// bytes read from the front of a data file to find its header, the three text lines or the v2 strings must fit in them
+constexpr size_t header_page_size = 4096;
+
+/// <summary>
+/// the header of a data file read from its first page alone. the strings are copied out of the page, so a listing holds a
+/// few short strings per data file and nothing at all for the files that are not
+/// </summary>
+struct data_file_summary
+{
+    std::string student_name;
+    std::string date;
+    std::string key;
+    // where the data starts and how long it is
+    uint64_t data_offset = 0;
+    uint64_t data_size = 0;
+    bool v2 = false;
+};
+
+/// <summary>
+/// true for a date line the way format_current_date writes it (yyyy-mm-dd), so a text file that merely has three lines is not
+/// taken for a data file
+/// </summary>
+bool is_data_file_date(std::string_view date)
+{
+    if (date.length() != 10 || date[4] != '-' || date[7] != '-') {
+        return false;
+    }
+    for (const size_t i : { 0, 1, 2, 3, 5, 6, 8, 9 }) {
+        if (date[i] < '0' || date[i] > '9') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// <summary>
+/// parse the header of a data file in either format with one bounded read of its first page, the data is never touched
+/// </summary>
+/// <param name="filename">file written by save_data_file or save_data_file_v2</param>
+/// <param name="header">receives the header, left alone unless the file is a data file</param>
+/// <returns>false if the file could not be read or its header is not within the first page</returns>
+bool read_data_file_header_page(const std::string& filename, data_file_summary& header)
+{
+    // the page lives on the calling thread's stack for this one file, only the strings that are kept are copied out of it
+    std::array<char, header_page_size> page;
+    size_t length = 0;
+    uint64_t file_size = 0;
+#if defined(_WIN32)
+    std::ifstream input_file(filename, std::ios::binary | std::ios::ate);
+    if (!input_file) {
+        return false;
+    }
+    file_size = static_cast<uint64_t>(input_file.tellg());
+    input_file.seekg(0);
+    input_file.read(page.data(), static_cast<std::streamsize>(page.size()));
+    length = static_cast<size_t>(input_file.gcount());
+#else
+    const int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat file_stat;
+    bool ok = fstat(fd, &file_stat) == 0;
+    file_size = ok ? static_cast<uint64_t>(file_stat.st_size) : 0;
+    while (ok && length < page.size()) {
+        const ssize_t count = pread(fd, page.data() + length, page.size() - length, static_cast<off_t>(length));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = count >= 0;
+        if (count <= 0) {
+            break;
+        }
+        length += static_cast<size_t>(count);
+    }
+    close(fd);
+    if (!ok) {
+        return false;
+    }
+#endif
+
+    const std::string_view bytes(page.data(), length);
+    if (is_data_file_v2(bytes)) {
+        // the strings follow the fixed header, the chunk table after them is not needed to list the file
+        if (length < data_file_v2_fixed_size) {
+            return false;
+        }
+        const char* in = page.data();
+        if (!is_valid_v2_header_size(get_u32(in + 12), file_size)) {
+            return false;
+        }
+        const uint32_t name_length = get_u32(in + 48);
+        const uint32_t date_length = get_u32(in + 52);
+        const uint32_t key_length = get_u32(in + 56);
+        if (data_file_v2_fixed_size + uint64_t(name_length) + date_length + key_length > length) {
+            return false;
+        }
+        const uint64_t data_offset = get_u64(in + 16);
+        const uint64_t data_size = get_u64(in + 24);
+        if (data_offset > file_size || data_size > file_size - data_offset) {
+            return false;
+        }
+        header.student_name = bytes.substr(data_file_v2_fixed_size, name_length);
+        header.date = bytes.substr(data_file_v2_fixed_size + name_length, date_length);
+        header.key = bytes.substr(data_file_v2_fixed_size + name_length + date_length, key_length);
+        header.data_offset = data_offset;
+        header.data_size = data_size;
+        header.v2 = true;
+        return true;
+    }
+
+    const char* cursor = page.data();
+    const char* const end = cursor + length;
+    std::string_view lines[3];
+    for (auto& line : lines) {
+        const auto* newline = static_cast<const char*>(std::memchr(cursor, '\n', static_cast<size_t>(end - cursor)));
+        if (newline == nullptr) {
+            return false;
+        }
+        line = std::string_view(cursor, static_cast<size_t>(newline - cursor));
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        cursor = newline + 1;
+    }
+    if (!is_data_file_date(lines[1])) {
+        return false;
+    }
+    header.student_name = lines[0];
+    header.date = lines[1];
+    header.key = lines[2];
+    header.data_offset = static_cast<uint64_t>(cursor - page.data());
+    header.data_size = file_size - header.data_offset;
+    header.v2 = false;
+    return true;
+}
+
+/// <summary>
+/// list every data file under a directory by student name and date, reading only the first page of each, several files at once
+/// </summary>
+/// <param name="directory">directory to scan, subdirectories included</param>
+/// <param name="thread_count">threads reading headers, 0 for one per hardware thread</param>
+/// <returns>false if the directory could not be scanned</returns>
+bool list_data_files(const std::string& directory, size_t thread_count)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::string> filenames;
+    std::error_code error;
+    for (auto entry = std::filesystem::recursive_directory_iterator(directory, std::filesystem::directory_options::skip_permission_denied, error);
+        !error && entry != std::filesystem::recursive_directory_iterator(); entry.increment(error)) {
+        if (entry->is_regular_file(error)) {
+            filenames.push_back(entry->path().string());
+        }
+    }
+    if (error) {
+        std::cout << "Could not read directory." << std::endl;
+        return false;
+    }
+    std::sort(filenames.begin(), filenames.end());
+
+    // each worker reads into a page on its own stack, what is kept per file is a few short strings
+    std::vector<data_file_summary> headers(filenames.size());
+    std::vector<char> found(filenames.size());
+    thread_pool pool(thread_count);
+    pool.parallel_for(filenames.size(), [&](size_t index)
+    {
+        found[index] = read_data_file_header_page(filenames[index], headers[index]);
+    });
+
+    size_t listed = 0;
+    for (size_t index = 0; index < filenames.size(); ++index) {
+        if (!found[index]) {
+            continue;
+        }
+        const auto& header = headers[index];
+        std::cout << header.student_name << "\t" << header.date << "\t" << header.data_size << "\t" << (header.v2 ? "v2" : "text") << "\t" << filenames[index] << "\n";
+        ++listed;
+    }
+
+    const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Listed: " << listed << " data files of " << filenames.size() << " files in " << std::fixed << std::setprecision(1) << elapsed << " ms" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+    return true;
+}
+
+#if !defined(_WIN32)
+/// <summary>
+/// one read or write handed to an async_io_engine, the tag comes back with its completion
+/// </summary>
+struct io_request
+{
+    int fd = -1;
+    char* buffer = nullptr;
+    size_t length = 0;
+    uint64_t offset = 0;
+    bool write = false;
+    // caller's slot number, must be below the engine's queue depth
+    size_t tag = 0;
+};
+
+/// <summary>
+/// a finished io_request
+/// </summary>
+struct io_completion
+{
+    size_t tag = 0;
+    // bytes transferred, or a negative errno
+    ssize_t result = 0;
+};
+
+/// <summary>
+/// keeps several reads and writes in flight while the caller works, and measures how much of their latency the caller never waited for
+/// </summary>
+class async_io_engine
+{
+public:
+    explicit async_io_engine(size_t queue_depth) : submit_times(queue_depth) {}
+    virtual ~async_io_engine() = default;
+
+    async_io_engine(const async_io_engine&) = delete;
+    async_io_engine& operator=(const async_io_engine&) = delete;
+
+    /// <summary>
+    /// queue a request, it is only guaranteed to start at the next flush or wait
+    /// </summary>
+    void submit(const io_request& request)
+    {
+        assert(request.tag < submit_times.size());
+        submit_times[request.tag] = clock::now();
+        ++request_total;
+        queue(request);
+    }
+
+    /// <summary>
+    /// start everything queued so far without waiting for any of it
+    /// </summary>
+    /// <returns>false if the requests could not be handed to the system</returns>
+    virtual bool flush() = 0;
+
+    /// <summary>
+    /// block until one request finishes
+    /// </summary>
+    /// <param name="completion">the finished request</param>
+    /// <returns>false if the engine failed and nothing more will complete</returns>
+    bool wait(io_completion& completion)
+    {
+        const auto start = clock::now();
+        if (!next_completion(completion))
+        {
+            return false;
+        }
+        const auto now = clock::now();
+        blocked_time += now - start;
+        latency_time += now - submit_times[completion.tag];
+        return true;
+    }
+
+    virtual const char* name() const = 0;
+
+    size_t queue_depth() const
+    {
+        return submit_times.size();
+    }
+
+    size_t request_count() const
+    {
+        return request_total;
+    }
+
+    /// <summary>
+    /// total time requests spent in flight, from submit until the caller picked up the completion
+    /// </summary>
+    double latency_seconds() const
+    {
+        return std::chrono::duration<double>(latency_time).count();
+    }
+
+    /// <summary>
+    /// time the caller spent blocked in wait, the part of the latency that was not hidden behind its own work
+    /// </summary>
+    double blocked_seconds() const
+    {
+        return std::chrono::duration<double>(blocked_time).count();
+    }
+
+protected:
+    virtual void queue(const io_request& request) = 0;
+    virtual bool next_completion(io_completion& completion) = 0;
+
+private:
+    using clock = std::chrono::steady_clock;
+    std::vector<clock::time_point> submit_times;
+    clock::duration latency_time{};
+    clock::duration blocked_time{};
+    size_t request_total = 0;
+};
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+/// <summary>
+/// io_uring engine driven through the raw system calls, so liburing is not needed. check is_open, the kernel may not allow it
+/// </summary>
+class uring_io_engine : public async_io_engine
+{
+public:
+    explicit uring_io_engine(size_t queue_depth) : async_io_engine(queue_depth), vectors(queue_depth)
+    {
+        io_uring_params params{};
+        ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, static_cast<unsigned>(queue_depth), &params));
+        if (ring_fd < 0)
+        {
+            return;
+        }
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        // newer kernels share one mapping between both rings
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+        sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED)
+        {
+            release();
+            return;
+        }
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            cq_ring = sq_ring;
+        }
+        else
+        {
+            cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        }
+        void* sqe_memory = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (cq_ring == MAP_FAILED || sqe_memory == MAP_FAILED)
+        {
+            sqes = sqe_memory == MAP_FAILED ? nullptr : static_cast<io_uring_sqe*>(sqe_memory);
+            release();
+            return;
+        }
+        sqes = static_cast<io_uring_sqe*>(sqe_memory);
+
+        char* sq = static_cast<char*>(sq_ring);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        char* cq = static_cast<char*>(cq_ring);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    ~uring_io_engine() override
+    {
+        release();
+    }
+
+    bool is_open() const
+    {
+        return ring_fd >= 0;
+    }
+
+    bool flush() override
+    {
+        while (unsubmitted > 0)
+        {
+            const int submitted = enter(unsubmitted, 0, 0);
+            if (submitted < 0)
+            {
+                return false;
+            }
+            unsubmitted -= static_cast<unsigned>(submitted);
+        }
+        return true;
+    }
+
+    const char* name() const override
+    {
+        return "io_uring";
+    }
+
+protected:
+    void queue(const io_request& request) override
+    {
+        // readv and writev rather than read and write so this works on every kernel that has io_uring
+        vectors[request.tag] = { request.buffer, request.length };
+
+        // we are the only producer, so the tail is ours to read plainly and publish with release
+        const unsigned tail = *sq_tail;
+        const unsigned index = tail & sq_mask;
+        io_uring_sqe& entry = sqes[index];
+        std::memset(&entry, 0, sizeof(entry));
+        entry.opcode = request.write ? IORING_OP_WRITEV : IORING_OP_READV;
+        entry.fd = request.fd;
+        entry.addr = reinterpret_cast<uint64_t>(&vectors[request.tag]);
+        entry.len = 1;
+        entry.off = request.offset;
+        entry.user_data = request.tag;
+        sq_array[index] = index;
+        std::atomic_ref<unsigned>(*sq_tail).store(tail + 1, std::memory_order_release);
+        ++unsubmitted;
+    }
+
+    bool next_completion(io_completion& completion) override
+    {
+        for (;;)
+        {
+            const unsigned head = *cq_head;
+            if (head != std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire))
+            {
+                const io_uring_cqe& entry = cqes[head & cq_mask];
+                completion.tag = static_cast<size_t>(entry.user_data);
+                completion.result = entry.res;
+                std::atomic_ref<unsigned>(*cq_head).store(head + 1, std::memory_order_release);
+                return true;
+            }
+
+            // nothing ready, submit anything still queued and sleep until at least one completion arrives
+            const int submitted = enter(unsubmitted, 1, IORING_ENTER_GETEVENTS);
+            if (submitted < 0)
+            {
+                return false;
+            }
+            unsubmitted -= static_cast<unsigned>(submitted);
+        }
+    }
+
+private:
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        for (;;)
+        {
+            const long result = syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+            if (result >= 0 || errno != EINTR)
+            {
+                return static_cast<int>(result);
+            }
+        }
+    }
+
+    void release()
+    {
+        if (sqes != nullptr)
+        {
+            munmap(sqes, sqes_size);
+        }
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+        {
+            munmap(cq_ring, cq_ring_size);
+        }
+        if (sq_ring != MAP_FAILED)
+        {
+            munmap(sq_ring, sq_ring_size);
+        }
+        if (ring_fd >= 0)
+        {
+            close(ring_fd);
+        }
+        sqes = nullptr;
+        sq_ring = cq_ring = MAP_FAILED;
+        ring_fd = -1;
+    }
+
+    std::vector<iovec> vectors;
+    int ring_fd = -1;
+    unsigned unsubmitted = 0;
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    size_t sqes_size = 0;
+    io_uring_sqe* sqes = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+#endif
+
+/// <summary>
+/// fallback engine, one thread per queue slot doing ordinary blocking pread and pwrite calls
+/// </summary>
+class thread_io_engine : public async_io_engine
+{
+public:
+    explicit thread_io_engine(size_t queue_depth) : async_io_engine(queue_depth)
+    {
+        for (size_t i = 0; i < queue_depth; ++i)
+        {
+            workers.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    ~thread_io_engine() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(engine_mutex);
+            stopping = true;
+        }
+        request_ready.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    bool flush() override
+    {
+        if (!staged.empty())
+        {
+            {
+                std::lock_guard<std::mutex> lock(engine_mutex);
+                requests.insert(requests.end(), staged.begin(), staged.end());
+            }
+            staged.clear();
+            request_ready.notify_all();
+        }
+        return true;
+    }
+
+    const char* name() const override
+    {
+        return "threads";
+    }
+
+protected:
+    void queue(const io_request& request) override
+    {
+        staged.push_back(request);
+    }
+
+    bool next_completion(io_completion& completion) override
+    {
+        flush();
+        std::unique_lock<std::mutex> lock(engine_mutex);
+        completion_ready.wait(lock, [this] { return !completions.empty(); });
+        completion = completions.front();
+        completions.pop_front();
+        return true;
+    }
+
+private:
+    void worker_loop()
+    {
+        for (;;)
+        {
+            io_request request;
+            {
+                std::unique_lock<std::mutex> lock(engine_mutex);
+                request_ready.wait(lock, [this] { return stopping || !requests.empty(); });
+                if (stopping)
+                {
+                    return;
+                }
+                request = requests.front();
+                requests.pop_front();
+            }
+
+            // keep going until the whole request is done, the same as a blocking read or write loop would
+            ssize_t result = 0;
+            size_t done = 0;
+            while (done < request.length)
+            {
+                const auto offset = static_cast<off_t>(request.offset + done);
+                const ssize_t count = request.write
+                    ? pwrite(request.fd, request.buffer + done, request.length - done, offset)
+                    : pread(request.fd, request.buffer + done, request.length - done, offset);
+                if (count < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (count <= 0)
+                {
+                    result = count < 0 ? -errno : static_cast<ssize_t>(done);
+                    break;
+                }
+                done += static_cast<size_t>(count);
+                result = static_cast<ssize_t>(done);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(engine_mutex);
+                completions.push_back({ request.tag, result });
+            }
+            completion_ready.notify_one();
+        }
+    }
+
+    std::vector<io_request> staged;
+    std::vector<std::thread> workers;
+    std::mutex engine_mutex;
+    std::condition_variable request_ready;
+    std::condition_variable completion_ready;
+    std::deque<io_request> requests;
+    std::deque<io_completion> completions;
+    bool stopping = false;
+};
+
+/// <summary>
+/// io_uring when the kernel has it and allow_uring is set, the thread engine otherwise
+/// </summary>
+std::unique_ptr<async_io_engine> make_io_engine(size_t queue_depth, bool allow_uring)
+{
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+    if (allow_uring)
+    {
+        auto engine = std::make_unique<uring_io_engine>(queue_depth);
+        if (engine->is_open())
+        {
+            return engine;
+        }
+    }
+#else
+    (void)allow_uring;
+#endif
+    return std::make_unique<thread_io_engine>(queue_depth);
+}
+
+/// <summary>
+/// encrypt or decrypt a file into the save_data_file format with queue_depth blocks being read or written while another is transformed
+/// </summary>
+/// <param name="input_filename">file to read</param>
+/// <param name="output_filename">file to write, header then transformed data</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="engine">engine that does the reads and writes</param>
+/// <param name="block_size">bytes per read and write</param>
+/// <param name="input_has_header">true when the input was itself written by save_data_file</param>
+/// <returns>true if the whole file was transformed and written</returns>
+bool async_stream_data_file(const std::string& input_filename, const std::string& output_filename, const std::string& key, async_io_engine& engine, size_t block_size, bool input_has_header)
+{
+    assert(block_size > 0);
+
+    // the header is a few short lines, read it with a stream to find the name and where the data starts
+    std::string student_name;
+    uint64_t input_offset = 0;
+    {
+        std::ifstream input_file(input_filename, std::ios::binary);
+        if (!input_file) {
+            std::cout << "Could not read file." << std::endl;
+            return false;
+        }
+        student_name = read_data_file_prefix(input_file, input_has_header);
+        input_offset = input_has_header && input_file ? static_cast<uint64_t>(input_file.tellg()) : 0;
+    }
+
+    std::ostringstream header;
+    write_data_file_header(header, student_name, key);
+    const std::string header_text = header.str();
+
+    const int input_fd = open(input_filename.c_str(), O_RDONLY | O_CLOEXEC);
+    const int output_fd = open(output_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    struct stat input_stat;
+    if (input_fd < 0 || output_fd < 0 || fstat(input_fd, &input_stat) != 0) {
+        std::cout << (input_fd < 0 ? "Could not read file." : "Could not write to file.") << std::endl;
+        if (input_fd >= 0) {
+            close(input_fd);
+        }
+        if (output_fd >= 0) {
+            close(output_fd);
+        }
+        return false;
+    }
+    posix_fadvise(input_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    const uint64_t input_size = static_cast<uint64_t>(input_stat.st_size);
+    const uint64_t data_size = input_size > input_offset ? input_size - input_offset : 0;
+    const uint64_t block_count = (data_size + block_size - 1) / block_size;
+    const uint64_t output_offset = header_text.length();
+    const auto pattern = make_key_pattern(key);
+
+    // every slot owns one block buffer and carries one block through read, transform and write
+    enum class slot_state { idle, reading, writing };
+    struct slot
+    {
+        std::vector<char> buffer;
+        slot_state state = slot_state::idle;
+        uint64_t block = 0;
+        size_t length = 0;
+        size_t done = 0;
+    };
+    std::vector<slot> slots(engine.queue_depth());
+    for (auto& entry : slots) {
+        entry.buffer.resize(block_size);
+    }
+
+    // the header is only a few bytes, write it directly
+    bool ok = pwrite(output_fd, header_text.data(), header_text.length(), 0) == static_cast<ssize_t>(header_text.length());
+
+    size_t in_flight = 0;
+    const auto submit_part = [&](size_t tag)
+    {
+        ++in_flight;
+        auto& entry = slots[tag];
+        const uint64_t position = entry.block * block_size + entry.done;
+        const bool write = entry.state == slot_state::writing;
+        engine.submit({ write ? output_fd : input_fd, entry.buffer.data() + entry.done, entry.length - entry.done,
+            (write ? output_offset : input_offset) + position, write, tag });
+    };
+
+    uint64_t next_block = 0;
+    uint64_t written_blocks = 0;
+    while (ok && written_blocks < block_count) {
+        // keep every idle slot busy reading the next block
+        for (size_t tag = 0; tag < slots.size() && next_block < block_count; ++tag) {
+            auto& entry = slots[tag];
+            if (entry.state != slot_state::idle) {
+                continue;
+            }
+            entry.state = slot_state::reading;
+            entry.block = next_block++;
+            entry.length = static_cast<size_t>(std::min<uint64_t>(block_size, data_size - entry.block * block_size));
+            entry.done = 0;
+            submit_part(tag);
+        }
+        if (!engine.flush()) {
+            ok = false;
+            break;
+        }
+
+        io_completion completion;
+        if (!engine.wait(completion)) {
+            ok = false;
+            break;
+        }
+        --in_flight;
+        if (completion.result <= 0) {
+            ok = false;
+            break;
+        }
+
+        auto& entry = slots[completion.tag];
+        entry.done += static_cast<size_t>(completion.result);
+        if (entry.done < entry.length) {
+            // a short read or write, ask for the rest
+            submit_part(completion.tag);
+            continue;
+        }
+
+        if (entry.state == slot_state::reading) {
+            // the other slots' requests stay in flight while this block is transformed
+            const auto block = std::span<char>(entry.buffer).first(entry.length);
+            encrypt_decrypt(block, block, pattern, static_cast<size_t>((entry.block * block_size) % pattern.key_length));
+            entry.state = slot_state::writing;
+            entry.done = 0;
+            submit_part(completion.tag);
+            engine.flush();
+        }
+        else {
+            entry.state = slot_state::idle;
+            ++written_blocks;
+        }
+    }
+
+    // after an error nothing may still be reading into the buffers when they are freed
+    for (io_completion completion; in_flight > 0 && engine.wait(completion); ) {
+        --in_flight;
+    }
+
+    close(input_fd);
+    if (close(output_fd) != 0 || !ok) {
+        std::cout << "Could not write to file." << std::endl;
+        return false;
+    }
+    return true;
+}
+#endif
+
+/// <summary>
+/// the original flow, the whole input, the encrypted copy and the decrypted copy are held in memory
+/// </summary>
+void encrypt_files_in_memory(const std::string& file_name, const std::string& encrypted_file_name, const std::string& decrypted_file_name, const std::string& key, thread_pool& pool, size_t chunk_size,
+    const file_read_hints& hints = {})
+{
+    const auto pattern = make_key_pattern(key);
+
+    // map the input so it is encrypted straight out of the page cache, read_file supplies the default text when it is missing.
+    // a read that should leave the page cache alone goes through read_file instead
+    std::unique_ptr<mapped_file> input_file;
+    if (!hints.drop_cache && !hints.direct) {
+        input_file = std::make_unique<mapped_file>(file_name);
+    }
+    const bool mapped = input_file && input_file->is_open();
+    const std::string fallback_string = mapped ? std::string() : read_file(file_name, hints);
+    const std::string_view source_string = mapped ? input_file->view() : std::string_view(fallback_string);
+
+    // get the student name from the data file
+    const std::string student_name = get_student_name(source_string);
+
+    // encrypt sourceString with key
+    std::string encrypted_string(source_string.length(), '\0');
+    encrypt_decrypt_parallel(source_string, encrypted_string, pattern, pool, chunk_size);
+
+    // save encrypted_string to file
+    save_data_file(encrypted_file_name, student_name, key, encrypted_string);
+
+    // decrypt encryptedString with key
+    std::string decrypted_string(encrypted_string.length(), '\0');
+    encrypt_decrypt_parallel(encrypted_string, decrypted_string, pattern, pool, chunk_size);
+
+    // save decrypted_string to file
+    save_data_file(decrypted_file_name, student_name, key, decrypted_string);
+}
+
+/// <summary>
+/// the in-memory flow with both outputs mapped, the input is encrypted straight into the encrypted file's mapping and that is
+/// decrypted straight into the decrypted file's mapping. falls back to encrypt_files_in_memory where a file cannot be mapped
+/// </summary>
+void encrypt_files_mapped(const std::string& file_name, const std::string& encrypted_file_name, const std::string& decrypted_file_name, const std::string& key, thread_pool& pool, size_t chunk_size)
+{
+    const auto pattern = make_key_pattern(key);
+
+    const mapped_file input_file(file_name);
+    if (!input_file.is_open()) {
+        encrypt_files_in_memory(file_name, encrypted_file_name, decrypted_file_name, key, pool, chunk_size);
+        return;
+    }
+    const std::string student_name = get_student_name(input_file.view());
+
+    if (!save_data_file_mapped(encrypted_file_name, student_name, key, input_file.view(), pattern, pool, chunk_size)) {
+        encrypt_files_in_memory(file_name, encrypted_file_name, decrypted_file_name, key, pool, chunk_size);
+        return;
+    }
+
+    // the encrypted file was just written through the page cache, so mapping it back reads nothing from disk
+    const mapped_file encrypted_file(encrypted_file_name);
+    std::string encrypted_name;
+    std::string_view encrypted_data;
+    if (!encrypted_file.is_open() || !split_data_file(encrypted_file.view(), encrypted_name, encrypted_data)) {
+        std::cout << "Could not read file." << std::endl;
+        return;
+    }
+
+    if (!save_data_file_mapped(decrypted_file_name, student_name, key, encrypted_data, pattern, pool, chunk_size)) {
+        std::string decrypted_string(encrypted_data.length(), '\0');
+        encrypt_decrypt_parallel(encrypted_data, decrypted_string, pattern, pool, chunk_size);
+        save_data_file(decrypted_file_name, student_name, key, decrypted_string);
+    }
+}
+
+/// <summary>
+/// the in-memory flow with the encrypted file in the v2 container, the decrypted file is read back through the container's chunk table
+/// </summary>
+/// <returns>false if a file could not be read or written or the container did not read back</returns>
+bool encrypt_files_v2(const std::string& file_name, const std::string& encrypted_file_name, const std::string& decrypted_file_name, const std::string& key, thread_pool& pool, size_t container_chunk_size)
+{
+    const auto pattern = make_key_pattern(key);
+
+    const mapped_file input_file(file_name);
+    const std::string fallback_string = input_file.is_open() ? std::string() : read_file(file_name);
+    const std::string_view source_string = input_file.is_open() ? input_file.view() : std::string_view(fallback_string);
+    const std::string student_name = get_student_name(source_string);
+
+    // encrypt a container chunk per task and take its crc in the same pass
+    std::string encrypted_string(source_string.length(), '\0');
+    std::vector<uint32_t> chunk_checksums((source_string.length() + container_chunk_size - 1) / container_chunk_size);
+    pool.parallel_for(chunk_checksums.size(), [&](size_t index)
+    {
+        const size_t begin = index * container_chunk_size;
+        const size_t length = std::min(container_chunk_size, source_string.length() - begin);
+        chunk_checksums[index] = encrypt_decrypt_checksummed(std::span<const char>(source_string.data() + begin, length),
+            std::span<char>(&encrypted_string[begin], length), pattern, begin % pattern.key_length, 0, false);
+    });
+    if (!save_data_file_v2(encrypted_file_name, student_name, key, encrypted_string, container_chunk_size, chunk_checksums)) {
+        return false;
+    }
+
+    // decrypt from the saved container, so every chunk crc is checked on the way
+    data_file_header header;
+    std::string decrypted_string;
+    if (!load_data_file(encrypted_file_name, key, pool, header, decrypted_string)) {
+        return false;
+    }
+    save_data_file(decrypted_file_name, header.student_name, key, decrypted_string);
+    return true;
+}
+
+/// <summary>
+/// decrypt a file in either format to a raw output file
+/// </summary>
+/// <param name="key">key to decrypt with, empty to use the key stored in the file</param>
+bool decrypt_data_file(const std::string& filename, const std::string& output_filename, const std::string& key, size_t threads)
+{
+    thread_pool pool(threads);
+    data_file_header header;
+    std::string plain_text;
+    if (!load_data_file(filename, key, pool, header, plain_text)) {
+        return false;
+    }
+
+    std::ofstream output_file(output_filename, std::ios::binary);
+    output_file.write(plain_text.data(), static_cast<std::streamsize>(plain_text.length()));
+    output_file.close();
+    if (!output_file) {
+        std::cout << "Could not write to file." << std::endl;
+        return false;
+    }
+    std::cout << "Read File: " << filename << " (" << header.student_name << ", " << header.date << ") - Decrypted To: " << output_filename << std::endl;
+    return true;
+}
+
+/// <summary>
+/// what the sidecar manifest of an incrementally encrypted file records about the last run
+/// </summary>
+struct chunk_manifest
+{
+    // bytes per chunk, the last chunk may be shorter
+    size_t chunk_size = 0;
+    // length of the header in front of the data
+    size_t header_length = 0;
+    // hmac-sha-256 of a fixed label under the key, a different key changes every chunk
+    std::string key_digest;
+    // length of the data after the header
+    uint64_t data_length = 0;
+    // hmac-sha-256 of each chunk's plain text under the key, in hex. keyed so the manifest says nothing about the plain text
+    // to anyone without the key, and collision resistant so an edit cannot leave a chunk looking unchanged
+    std::vector<std::string> chunk_digests;
+};
+
+// first line of a chunk manifest
+constexpr std::string_view chunk_manifest_magic = "aenc-chunks 2";
+
+/// <summary>
+/// a digest as lowercase hex, the way the chunk manifest stores it
+/// </summary>
+std::string digest_to_hex(const std::array<uint8_t, 32>& digest)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string hex(digest.size() * 2, '0');
+    for (size_t i = 0; i < digest.size(); ++i)
+    {
+        hex[2 * i] = digits[digest[i] >> 4];
+        hex[2 * i + 1] = digits[digest[i] & 15];
+    }
+    return hex;
+}
+
+/// <summary>
+/// the sidecar manifest kept next to an incrementally encrypted file
+/// </summary>
+std::string chunk_manifest_filename(const std::string& encrypted_file_name)
+{
+    return encrypted_file_name + ".chunks";
+}
+
+/// <summary>
+/// read a chunk manifest
+/// </summary>
+/// <returns>false if the manifest is missing or not one this version wrote, the caller then starts over</returns>
+bool load_chunk_manifest(const std::string& filename, chunk_manifest& manifest)
+{
+    std::ifstream manifest_file(filename);
+    std::string magic;
+    if (!std::getline(manifest_file, magic) || magic != chunk_manifest_magic) {
+        return false;
+    }
+
+    std::string field;
+    size_t chunk_count = 0;
+    manifest_file >> field >> manifest.chunk_size >> field >> manifest.header_length >> field >> manifest.key_digest
+        >> field >> manifest.data_length >> field >> chunk_count;
+    if (!manifest_file || manifest.chunk_size == 0 || chunk_count != (manifest.data_length + manifest.chunk_size - 1) / manifest.chunk_size) {
+        return false;
+    }
+
+    manifest.chunk_digests.resize(chunk_count);
+    for (auto& digest : manifest.chunk_digests) {
+        manifest_file >> digest;
+    }
+    return static_cast<bool>(manifest_file);
+}
+
+/// <summary>
+/// write a chunk manifest
+/// </summary>
+/// <returns>false if it could not be written</returns>
+bool save_chunk_manifest(const std::string& filename, const chunk_manifest& manifest)
+{
+    // binary so every line ends in one byte everywhere, update_chunk_manifest relies on it
+    std::ofstream manifest_file(filename, std::ios::binary);
+    manifest_file << chunk_manifest_magic << "\n"
+        << "chunk_size " << manifest.chunk_size << "\n"
+        << "header_length " << manifest.header_length << "\n"
+        << "key_digest " << manifest.key_digest << "\n"
+        << "data_length " << manifest.data_length << "\n"
+        << "chunks " << manifest.chunk_digests.size() << "\n";
+    for (const auto& digest : manifest.chunk_digests) {
+        manifest_file << digest << "\n";
+    }
+    manifest_file.close();
+    return static_cast<bool>(manifest_file);
+}
+
+/// <summary>
+/// write the digests of the changed chunks into the manifest file in place, every digest line is the same length so each
+/// sits at a fixed offset. the whole manifest is written instead when its header lines changed with the data length
+/// </summary>
+/// <param name="filename">manifest file to update</param>
+/// <param name="manifest">the new manifest</param>
+/// <param name="previous">the manifest the file holds now</param>
+/// <param name="changed">indices of the chunks whose digests changed</param>
+/// <returns>false if it could not be written</returns>
+bool update_chunk_manifest(const std::string& filename, const chunk_manifest& manifest, const chunk_manifest& previous, const std::vector<size_t>& changed)
+{
+    if (manifest.data_length != previous.data_length || manifest.chunk_digests.size() != previous.chunk_digests.size()) {
+        return save_chunk_manifest(filename, manifest);
+    }
+
+    std::ostringstream header;
+    header << chunk_manifest_magic << "\n"
+        << "chunk_size " << manifest.chunk_size << "\n"
+        << "header_length " << manifest.header_length << "\n"
+        << "key_digest " << manifest.key_digest << "\n"
+        << "data_length " << manifest.data_length << "\n"
+        << "chunks " << manifest.chunk_digests.size() << "\n";
+    const size_t header_length = header.str().length();
+    const size_t line_length = 2 * std::tuple_size_v<std::array<uint8_t, 32>> + 1;
+
+    std::fstream manifest_file(filename, std::ios::in | std::ios::out | std::ios::binary);
+    for (const size_t index : changed) {
+        manifest_file.seekp(static_cast<std::streamoff>(header_length + index * line_length));
+        manifest_file.write(manifest.chunk_digests[index].data(), static_cast<std::streamsize>(manifest.chunk_digests[index].length()));
+    }
+    manifest_file.close();
+    return static_cast<bool>(manifest_file);
+}
+
+/// <summary>
+/// encrypt the input into the save_data_file format, rewriting only the chunks whose plain text changed since the last run.
+/// a sidecar manifest holds a keyed sha-256 (hmac) of every chunk's plain text, each run hashes the input, encrypts just the chunks that
+/// differ and writes them in place at their offset and key phase. the whole file is written when there is no usable manifest
+/// (first run, different key, chunk size or name line length, or an encrypted file that does not match it).
+/// only xor keys are accepted: a chacha20 or aes256ctr file gets a fresh nonce each time it is written, and rewriting changed
+/// chunks under the old nonce instead would xor two plain texts with the same keystream
+/// </summary>
+/// <param name="file_name">file to encrypt</param>
+/// <param name="encrypted_file_name">file to create or update</param>
+/// <param name="key">key to use in encryption</param>
+/// <param name="pool">threads to hash and encrypt with</param>
+/// <param name="chunk_size">bytes per manifest chunk</param>
+/// <returns>false if a file could not be read or written, or the key is a cipher key</returns>
+bool encrypt_file_incremental(const std::string& file_name, const std::string& encrypted_file_name, const std::string& key, thread_pool& pool, size_t chunk_size)
+{
+    assert(chunk_size > 0);
+    if (cipher_prefix_length(key) != 0) {
+        std::cout << "--incremental only works with the xor cipher, a chacha20 or aes256ctr file needs a new nonce every time it is written" << std::endl;
+        return false;
+    }
+    const auto pattern = make_key_pattern(key);
+
+    const mapped_file input_file(file_name);
+    const std::string fallback_string = input_file.is_open() ? std::string() : read_file(file_name);
+    const std::string_view source_string = input_file.is_open() ? input_file.view() : std::string_view(fallback_string);
+    const std::string header = format_data_file_header(get_student_name(source_string), key);
+
+    chunk_manifest manifest;
+    manifest.chunk_size = chunk_size;
+    manifest.header_length = header.length();
+    manifest.key_digest = digest_to_hex(hmac_sha256(key, chunk_manifest_magic));
+    manifest.data_length = source_string.length();
+    manifest.chunk_digests.resize((source_string.length() + chunk_size - 1) / chunk_size);
+    pool.parallel_for(manifest.chunk_digests.size(), [&](size_t index)
+    {
+        const size_t begin = index * chunk_size;
+        manifest.chunk_digests[index] = digest_to_hex(hmac_sha256(key, source_string.substr(begin, std::min(chunk_size, source_string.length() - begin))));
+    });
+
+    // the old manifest only helps if it describes the encrypted file that is actually there
+    chunk_manifest previous;
+    const std::string manifest_filename = chunk_manifest_filename(encrypted_file_name);
+    std::error_code error;
+    const uint64_t encrypted_size = std::filesystem::file_size(encrypted_file_name, error);
+    const bool usable = !error && load_chunk_manifest(manifest_filename, previous) && previous.chunk_size == manifest.chunk_size
+        && previous.header_length == manifest.header_length && previous.key_digest == manifest.key_digest
+        && encrypted_size == previous.header_length + previous.data_length;
+
+    if (!usable) {
+        if (!save_data_file_mapped(encrypted_file_name, get_student_name(source_string), key, source_string, pattern, pool, default_chunk_size)) {
+            std::string encrypted_string(source_string.length(), '\0');
+            encrypt_decrypt_parallel(source_string, encrypted_string, pattern, pool, default_chunk_size);
+            save_data_file(encrypted_file_name, get_student_name(source_string), key, encrypted_string);
+        }
+        std::cout << "Incremental: no usable manifest, all " << manifest.chunk_digests.size() << " chunks written" << std::endl;
+        return save_chunk_manifest(manifest_filename, manifest);
+    }
+
+    // a chunk changed if its plain text hashes differently or it did not exist, or had another length, last time
+    std::vector<size_t> changed;
+    for (size_t index = 0; index < manifest.chunk_digests.size(); ++index) {
+        const uint64_t begin = uint64_t(index) * chunk_size;
+        const bool existed = index < previous.chunk_digests.size()
+            && std::min<uint64_t>(chunk_size, previous.data_length - begin) == std::min<uint64_t>(chunk_size, manifest.data_length - begin);
+        if (!existed || previous.chunk_digests[index] != manifest.chunk_digests[index]) {
+            changed.push_back(index);
+        }
+    }
+
+    // only the changed chunks are encrypted, so memory and writes are both proportional to the change
+    std::string encrypted_chunks(changed.size() * chunk_size, '\0');
+    pool.parallel_for(changed.size(), [&](size_t slot)
+    {
+        const size_t begin = changed[slot] * chunk_size;
+        const size_t length = std::min(chunk_size, source_string.length() - begin);
+        encrypt_decrypt(std::span<const char>(source_string.data() + begin, length), std::span<char>(&encrypted_chunks[slot * chunk_size], length),
+            pattern, begin % pattern.key_length);
+    });
+
+    if (manifest.data_length != previous.data_length) {
+        std::filesystem::resize_file(encrypted_file_name, header.length() + manifest.data_length, error);
+    }
+    std::fstream encrypted_file(encrypted_file_name, std::ios::in | std::ios::out | std::ios::binary);
+    if (error || !encrypted_file) {
+        std::cout << "Could not write to file." << std::endl;
+        return false;
+    }
+
+    // the date line may have moved on since the last run, the header is the same length so it is rewritten in place too
+    uint64_t bytes_written = header.length();
+    encrypted_file.write(header.data(), static_cast<std::streamsize>(header.length()));
+    for (size_t slot = 0; slot < changed.size(); ++slot) {
+        const size_t begin = changed[slot] * chunk_size;
+        const size_t length = std::min(chunk_size, source_string.length() - begin);
+        encrypted_file.seekp(static_cast<std::streamoff>(header.length() + begin));
+        encrypted_file.write(&encrypted_chunks[slot * chunk_size], static_cast<std::streamsize>(length));
+        bytes_written += length;
+    }
+    encrypted_file.close();
+    if (!encrypted_file) {
+        std::cout << "Could not write to file." << std::endl;
+        return false;
+    }
+
+    std::cout << "Incremental: " << changed.size() << " of " << manifest.chunk_digests.size() << " chunks rewritten, " << bytes_written << " bytes written" << std::endl;
+    return update_chunk_manifest(manifest_filename, manifest, previous, changed);
+}
+
+// bytes verify_round_trip decrypts and compares at a time, small enough to live on the stack and stay in l1 cache
+constexpr size_t verify_block_size = size_t(16) << 10;
+
+/// <summary>
+/// check that decrypting encrypted gives back source, one small block at a time so no decrypted copy is ever built
+/// </summary>
+/// <param name="source">the original data</param>
+/// <param name="encrypted">source after encrypt_decrypt with the same key</param>
+/// <param name="pattern">pattern built from the key by make_key_pattern</param>
+/// <returns>offset of the first byte that does not round trip, or std::string::npos if they all do</returns>
+size_t verify_round_trip(std::span<const char> source, std::span<const char> encrypted, const key_pattern& pattern)
+{
+    char block[verify_block_size];
+    const size_t length = std::min(source.size(), encrypted.size());
+
+    for (size_t offset = 0; offset < length; offset += verify_block_size)
+    {
+        const size_t count = std::min(verify_block_size, length - offset);
+        encrypt_decrypt(encrypted.subspan(offset, count), std::span<char>(block, count), pattern, offset);
+
+        // memcmp is vectorized, only a block that differs is walked byte by byte to find where
+        const char* expected = source.data() + offset;
+        if (std::memcmp(block, expected, count) != 0)
+        {
+            return offset + static_cast<size_t>(std::mismatch(block, block + count, expected).first - block);
+        }
+    }
+
+    // a length difference is a mismatch at the end of the shorter one
+    return source.size() == encrypted.size() ? std::string::npos : length;
+}
+
+/// <summary>
+/// encrypt and save the input as encrypt_files_in_memory does, then prove the encrypted data decrypts back to the input
+/// without writing or even holding the decrypted copy
+/// </summary>
+/// <returns>true if every byte round trips</returns>
+bool encrypt_file_and_verify(const std::string& file_name, const std::string& encrypted_file_name, const std::string& key, thread_pool& pool, size_t chunk_size)
+{
+    const auto pattern = make_key_pattern(key);
+
+    const mapped_file input_file(file_name);
+    const std::string fallback_string = input_file.is_open() ? std::string() : read_file(file_name);
+    const std::string_view source_string = input_file.is_open() ? input_file.view() : std::string_view(fallback_string);
+
+    std::string encrypted_string(source_string.length(), '\0');
+    encrypt_decrypt_parallel(source_string, encrypted_string, pattern, pool, chunk_size);
+    save_data_file(encrypted_file_name, get_student_name(source_string), key, encrypted_string);
+
+    const size_t mismatch = verify_round_trip(source_string, encrypted_string, pattern);
+    if (mismatch != std::string::npos)
+    {
+        std::cout << "Round trip mismatch at byte " << mismatch << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// the same flow as encrypt_files_in_memory in constant memory, at most one block of the file is held at a time
+/// </summary>
+bool encrypt_files_streaming(const std::string& file_name, const std::string& encrypted_file_name, const std::string& decrypted_file_name, const std::string& key, size_t block_size)
+{
+    // encrypt the input into the encrypted file, then decrypt that file's data into the decrypted file
+    return stream_data_file(file_name, encrypted_file_name, key, block_size, false)
+        && stream_data_file(encrypted_file_name, decrypted_file_name, key, block_size, true);
+}
+
+#if !defined(_WIN32)
+/// <summary>
+/// the streaming flow with reads and writes kept in flight by an async engine, reports how much io latency was hidden
+/// </summary>
+bool encrypt_files_async(const std::string& file_name, const std::string& encrypted_file_name, const std::string& decrypted_file_name, const std::string& key,
+    size_t block_size, size_t queue_depth, bool allow_uring)
+{
+    const auto engine = make_io_engine(queue_depth, allow_uring);
+    const bool ok = async_stream_data_file(file_name, encrypted_file_name, key, *engine, block_size, false)
+        && async_stream_data_file(encrypted_file_name, decrypted_file_name, key, *engine, block_size, true);
+
+    const double latency = engine->latency_seconds();
+    const double blocked = engine->blocked_seconds();
+    const double hidden = latency > 0 ? 100.0 * (1.0 - blocked / latency) : 0.0;
+    std::cout << "IO engine: " << engine->name() << ", queue depth " << queue_depth << ", block size " << block_size
+        << " - " << engine->request_count() << " requests, " << std::fixed << std::setprecision(3) << latency * 1000 << " ms in flight, "
+        << blocked * 1000 << " ms waited, " << std::setprecision(1) << hidden << "% hidden" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+    return ok;
+}
+#endif
+
+/// <summary>
+/// bounded queue for exactly one pushing thread and one popping thread. the indices only ever grow, so neither side takes a lock,
+/// and a side that finds the ring full or empty sleeps on the other side's index until it moves
+/// </summary>
+template <typename T>
+class spsc_ring
+{
+public:
+    /// <summary>
+    /// make room for at least capacity values
+    /// </summary>
+    explicit spsc_ring(size_t capacity)
+        : slots(std::bit_ceil(std::max<size_t>(capacity, 1))), mask(slots.size() - 1)
+    {
+    }
+
+    /// <summary>
+    /// add a value, waiting while the ring is full. only the producer thread may call this
+    /// </summary>
+    void push(T value)
+    {
+        const size_t tail = tail_index.load(std::memory_order_relaxed);
+        for (size_t head = head_index.load(std::memory_order_acquire); tail - head == slots.size(); head = head_index.load(std::memory_order_acquire))
+        {
+            head_index.wait(head, std::memory_order_acquire);
+        }
+        slots[tail & mask] = std::move(value);
+        tail_index.store(tail + 1, std::memory_order_release);
+        tail_index.notify_one();
+    }
+
+    /// <summary>
+    /// take the oldest value, waiting while the ring is empty. only the consumer thread may call this
+    /// </summary>
+    T pop()
+    {
+        const size_t head = head_index.load(std::memory_order_relaxed);
+        for (size_t tail = tail_index.load(std::memory_order_acquire); tail == head; tail = tail_index.load(std::memory_order_acquire))
+        {
+            tail_index.wait(tail, std::memory_order_acquire);
+        }
+        T value = std::move(slots[head & mask]);
+        head_index.store(head + 1, std::memory_order_release);
+        head_index.notify_one();
+        return value;
+    }
+
+private:
+    std::vector<T> slots;
+    const size_t mask;
+    // each index on its own cache line, so the producer and consumer do not invalidate each other's line on every move
+    alignas(64) std::atomic<size_t> head_index{ 0 };
+    alignas(64) std::atomic<size_t> tail_index{ 0 };
+};
+
+/// <summary>
+/// busy time of each pipelined stage, the wall time approaches the largest of them when the stages overlap
+/// </summary>
+struct pipeline_timings
+{
+    double read_seconds = 0;
+    double transform_seconds = 0;
+    double write_seconds = 0;
+    double wall_seconds = 0;
+};
+
+/// <summary>
+/// encrypt or decrypt a file into the save_data_file format with reading, transforming and writing each on its own thread.
+/// block_count blocks are allocated up front and passed reader to transformer to writer and back to the reader through
+/// spsc rings, so the reader stalls when every block is waiting on a slower stage and memory never grows past them
+/// </summary>
+/// <param name="input_filename">file to read</param>
+/// <param name="output_filename">file to write, header then transformed data</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="block_size">bytes per block</param>
+/// <param name="block_count">blocks in the pipeline</param>
+/// <param name="input_has_header">true when the input was itself written by save_data_file, its header is replaced rather than transformed</param>
+/// <param name="timings">receives the busy time of each stage, added to what is there</param>
+/// <returns>true if the whole file was transformed and written</returns>
+bool pipeline_data_file(const std::string& input_filename, const std::string& output_filename, const std::string& key, size_t block_size, size_t block_count,
+    bool input_has_header, pipeline_timings& timings)
+{
+    assert(block_size > 0 && block_count > 0);
+    using clock = std::chrono::steady_clock;
+    const auto seconds_since = [](clock::time_point start) { return std::chrono::duration<double>(clock::now() - start).count(); };
+    const auto wall_start = clock::now();
+
+    std::ifstream input_file(input_filename, std::ios::binary);
+    if (!input_file) {
+        std::cout << "Could not read file." << std::endl;
+        return false;
+    }
+    const std::string student_name = read_data_file_prefix(input_file, input_has_header);
+
+    std::ofstream output_file(output_filename, std::ios::binary);
+    write_data_file_header(output_file, student_name, key);
+    if (!output_file) {
+        std::cout << "Could not write to file." << std::endl;
+        return false;
+    }
+
+    const auto pattern = make_key_pattern(key);
+
+    // the rings carry block indices, end_of_data follows the last filled block through the transformer to the writer
+    constexpr size_t end_of_data = SIZE_MAX;
+    std::vector<std::vector<char>> blocks(block_count, std::vector<char>(block_size));
+    std::vector<size_t> lengths(block_count);
+    spsc_ring<size_t> free_blocks(block_count);
+    spsc_ring<size_t> read_blocks(block_count + 1);
+    spsc_ring<size_t> transformed_blocks(block_count + 1);
+    for (size_t index = 0; index < block_count; ++index) {
+        free_blocks.push(index);
+    }
+    // a failed write stops the reader, the blocks still in flight drain through as usual
+    std::atomic<bool> write_failed{ false };
+    double transform_seconds = 0;
+    double write_seconds = 0;
+
+    std::thread transformer([&]
+    {
+        uint64_t total = 0;
+        for (size_t index = read_blocks.pop(); index != end_of_data; index = read_blocks.pop()) {
+            const auto start = clock::now();
+            const auto block = std::span<char>(blocks[index]).first(lengths[index]);
+            encrypt_decrypt(block, block, pattern, static_cast<size_t>(total % pattern.key_length));
+            total += block.size();
+            transform_seconds += seconds_since(start);
+            transformed_blocks.push(index);
+        }
+        transformed_blocks.push(end_of_data);
+    });
+
+    std::thread writer([&]
+    {
+        for (size_t index = transformed_blocks.pop(); index != end_of_data; index = transformed_blocks.pop()) {
+            if (!write_failed.load(std::memory_order_relaxed)) {
+                const auto start = clock::now();
+                output_file.write(blocks[index].data(), static_cast<std::streamsize>(lengths[index]));
+                write_seconds += seconds_since(start);
+                if (!output_file) {
+                    write_failed.store(true, std::memory_order_relaxed);
+                }
+            }
+            free_blocks.push(index);
+        }
+    });
+
+    // this thread is the reader
+    double read_seconds = 0;
+    while (input_file && !write_failed.load(std::memory_order_relaxed)) {
+        const size_t index = free_blocks.pop();
+        const auto start = clock::now();
+        input_file.read(blocks[index].data(), static_cast<std::streamsize>(block_size));
+        lengths[index] = static_cast<size_t>(input_file.gcount());
+        read_seconds += seconds_since(start);
+        if (lengths[index] == 0) {
+            free_blocks.push(index);
+            break;
+        }
+        read_blocks.push(index);
+    }
+    read_blocks.push(end_of_data);
+
+    transformer.join();
+    writer.join();
+    output_file.close();
+
+    timings.read_seconds += read_seconds;
+    timings.transform_seconds += transform_seconds;
+    timings.write_seconds += write_seconds;
+    timings.wall_seconds += seconds_since(wall_start);
+
+    if (!output_file || input_file.bad()) {
+        std::cout << "Could not write to file." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// the streaming flow with the reader, transformer and writer of each file overlapped, reports how close the overlap came to
+/// the slowest stage
+/// </summary>
+bool encrypt_files_pipelined(const std::string& file_name, const std::string& encrypted_file_name, const std::string& decrypted_file_name, const std::string& key,
+    size_t block_size, size_t block_count)
+{
+    pipeline_timings timings;
+    const bool ok = pipeline_data_file(file_name, encrypted_file_name, key, block_size, block_count, false, timings)
+        && pipeline_data_file(encrypted_file_name, decrypted_file_name, key, block_size, block_count, true, timings);
+
+    std::cout << "Pipeline: " << block_count << " blocks of " << block_size << " bytes - " << std::fixed << std::setprecision(3)
+        << timings.read_seconds * 1000 << " ms reading, " << timings.transform_seconds * 1000 << " ms transforming, "
+        << timings.write_seconds * 1000 << " ms writing, " << timings.wall_seconds * 1000 << " ms wall" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+    return ok;
+}
+
+/// <summary>
+/// one line of a batch manifest
+/// </summary>
+struct batch_job
+{
+    std::string input_filename;
+    std::string output_filename;
+    std::string key;
+    // the input is a data file to decrypt rather than plain text to encrypt
+    bool decrypt = false;
+};
+
+/// <summary>
+/// how one batch job went
+/// </summary>
+struct batch_result
+{
+    bool ok = false;
+    uint64_t bytes = 0;
+    double seconds = 0;
+};
+
+// files with more data than this are split into chunks of this size that idle workers can steal
+constexpr size_t batch_split_size = size_t(8) << 20;
+
+/// <summary>
+/// read a batch manifest, one job per line: input path, output path, key, then encrypt or decrypt.
+/// fields are separated by tabs, or by spaces on lines without tabs. blank lines and lines starting with # are skipped.
+/// the key takes the forms the usage text lists: a plain <key> for xor, chacha20:<passphrase> or aes256ctr:<passphrase>
+/// for a cipher with a fresh nonce per file, or a saved <cipher>:<24 hex digits>:<passphrase> key line that reuses its nonce.
+/// a job that reads another job's output, or writes over another job's input or output, runs after that job, so one
+/// manifest can encrypt a file and then decrypt the result
+/// </summary>
+/// <param name="filename">manifest to read</param>
+/// <param name="jobs">jobs read from it</param>
+/// <returns>false if the manifest could not be read or a line was malformed</returns>
+bool read_batch_manifest(const std::string& filename, std::vector<batch_job>& jobs)
+{
+    std::ifstream manifest(filename);
+    if (!manifest) {
+        std::cout << "Could not read file." << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (size_t line_number = 1; std::getline(manifest, line); ++line_number) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::vector<std::string> fields;
+        if (line.find('\t') != std::string::npos) {
+            std::istringstream fields_stream(line);
+            for (std::string field; std::getline(fields_stream, field, '\t'); ) {
+                fields.push_back(field);
+            }
+        }
+        else {
+            std::istringstream fields_stream(line);
+            for (std::string field; fields_stream >> field; ) {
+                fields.push_back(field);
+            }
+        }
+
+        if (fields.size() != 4 || fields[2].empty() || (fields[3] != "encrypt" && fields[3] != "decrypt")) {
+            std::cout << "Bad manifest line " << line_number << ": " << line << std::endl;
+            return false;
+        }
+        jobs.push_back({ fields[0], fields[1], fields[2], fields[3] == "decrypt" });
+    }
+    return true;
+}
+
+/// <summary>
+/// queue one batch job on the pool. it produces the same file the single file modes would: an encrypt job transforms the
+/// whole input, a decrypt job finds the data of either file format the way load_data_file does (checking a v2 file's chunk
+/// crcs) and transforms it, and both save with save_data_file
+/// </summary>
+/// <param name="pool">pool to run on</param>
+/// <param name="job">job to run, must outlive the pool's work</param>
+/// <param name="result">filled in when the job finishes, must outlive the pool's work</param>
+void submit_batch_job(work_stealing_pool& pool, const batch_job& job, const file_read_hints& hints, batch_result& result)
+{
+    pool.submit([&pool, &job, &hints, &result]
+    {
+        using clock = std::chrono::steady_clock;
+
+        // everything the chunks of one file share, freed by whichever chunk finishes last
+        struct file_state
+        {
+            // inputs are mapped unless the hints ask for a read that leaves the page cache alone
+            file_state(const std::string& filename, const file_read_hints& hints)
+            {
+                if (hints.drop_cache || hints.direct) {
+                    opened = read_whole_file(filename, contents, hints);
+                }
+                else {
+                    input = std::make_unique<mapped_file>(filename);
+                    opened = input->is_open();
+                }
+            }
+
+            std::string_view view() const
+            {
+                return input ? input->view() : std::string_view(contents);
+            }
+
+            clock::time_point start = clock::now();
+            std::unique_ptr<mapped_file> input;
+            std::string contents;
+            bool opened = false;
+            std::string student_name;
+            std::string_view data;
+            // the chunk table of a v2 input, checked once the data is decrypted
+            data_file_v2_layout layout;
+            std::string output;
+            // the key saved with the output, an encrypt job's cipher key gets its own nonce
+            std::string key;
+            key_pattern pattern;
+            std::atomic<size_t> remaining_chunks{ 0 };
+        };
+        const auto state = std::make_shared<file_state>(job.input_filename, hints);
+        if (!state->opened) {
+            std::cout << "Could not read file: " << job.input_filename << std::endl;
+            return;
+        }
+        if (job.decrypt) {
+            data_file_header header;
+            if (!parse_data_file(state->view(), job.input_filename, header, state->data, state->layout)) {
+                return;
+            }
+            state->student_name = header.student_name;
+            state->key = resolve_cipher_key(job.key, header.key);
+        }
+        else {
+            state->data = state->view();
+            state->student_name = get_student_name(state->data);
+            state->key = add_cipher_nonce(job.key);
+        }
+
+        state->output.resize(state->data.length());
+        state->pattern = make_key_pattern(state->key);
+
+        const auto finish = [&job, &result](file_state& file)
+        {
+            const size_t bad_chunk = check_data_file_v2(file.view(), file.layout);
+            if (bad_chunk != file.layout.chunks.size()) {
+                std::cout << "Checksum mismatch in chunk " << bad_chunk << " at offset " << file.layout.chunks[bad_chunk].offset << ": " << job.input_filename << std::endl;
+                return;
+            }
+            save_data_file(job.output_filename, file.student_name, file.key, file.output);
+            result.bytes = file.data.length();
+            result.seconds = std::chrono::duration<double>(clock::now() - file.start).count();
+            result.ok = true;
+        };
+        const auto run_chunk = [state, finish](size_t chunk)
+        {
+            const size_t begin = chunk * batch_split_size;
+            const size_t length = std::min(batch_split_size, state->data.length() - begin);
+            encrypt_decrypt(std::span<const char>(state->data).subspan(begin, length), std::span<char>(state->output).subspan(begin, length),
+                state->pattern, begin);
+            if (state->remaining_chunks.fetch_sub(1) == 1) {
+                finish(*state);
+            }
+        };
+
+        const size_t chunk_count = (state->data.length() + batch_split_size - 1) / batch_split_size;
+        if (chunk_count == 0) {
+            finish(*state);
+            return;
+        }
+        state->remaining_chunks = chunk_count;
+        // the other chunks go on this worker's deque for idle workers to steal, this worker starts on the first
+        for (size_t chunk = 1; chunk < chunk_count; ++chunk) {
+            pool.submit([run_chunk, chunk] { run_chunk(chunk); });
+        }
+        run_chunk(0);
+    });
+}
+
+/// <summary>
+/// find the earlier jobs of a manifest that each job has to wait for: the ones whose output it reads, whose input it
+/// overwrites, or whose output it overwrites. jobs with nothing in common depend on nothing and can run together
+/// </summary>
+/// <param name="jobs">jobs in manifest order</param>
+/// <returns>for each job, the indices of the earlier jobs it depends on</returns>
+std::vector<std::vector<size_t>> find_batch_dependencies(const std::vector<batch_job>& jobs)
+{
+    // compare paths the way the filesystem would resolve them, so ./a and a are the same file
+    const auto resolve = [](const std::string& filename)
+    {
+        // relative paths are made absolute first, weakly_canonical leaves them relative when no part of them exists yet
+        std::error_code error;
+        const auto path = std::filesystem::weakly_canonical(std::filesystem::absolute(filename, error), error);
+        return error ? std::filesystem::path(filename).lexically_normal() : path;
+    };
+    std::vector<std::filesystem::path> inputs;
+    std::vector<std::filesystem::path> outputs;
+    for (const auto& job : jobs) {
+        inputs.push_back(resolve(job.input_filename));
+        outputs.push_back(resolve(job.output_filename));
+    }
+
+    std::vector<std::vector<size_t>> dependencies(jobs.size());
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        for (size_t j = 0; j < i; ++j) {
+            if (inputs[i] == outputs[j] || outputs[i] == inputs[j] || outputs[i] == outputs[j]) {
+                dependencies[i].push_back(j);
+            }
+        }
+    }
+    return dependencies;
+}
+
+/// <summary>
+/// run every job in a manifest across a work stealing pool and report per file and total throughput. independent jobs run
+/// together, a job that depends on earlier ones (see find_batch_dependencies) runs in a later wave once they are done and
+/// is reported as failed without running if any of them failed
+/// </summary>
+/// <param name="manifest_filename">manifest to run</param>
+/// <param name="thread_count">worker threads, 0 for one per hardware thread</param>
+/// <param name="hints">how the inputs are read</param>
+/// <returns>true if every job succeeded</returns>
+bool run_batch(const std::string& manifest_filename, size_t thread_count, const file_read_hints& hints = {})
+{
+    std::vector<batch_job> jobs;
+    if (!read_batch_manifest(manifest_filename, jobs)) {
+        return false;
+    }
+
+    std::vector<batch_result> results(jobs.size());
+    const auto dependencies = find_batch_dependencies(jobs);
+    std::vector<size_t> waves(jobs.size(), 0);
+    size_t wave_count = jobs.empty() ? 0 : 1;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        for (const size_t j : dependencies[i]) {
+            waves[i] = std::max(waves[i], waves[j] + 1);
+        }
+        wave_count = std::max(wave_count, waves[i] + 1);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    {
+        work_stealing_pool pool(thread_count);
+        for (size_t wave = 0; wave < wave_count; ++wave) {
+            for (size_t i = 0; i < jobs.size(); ++i) {
+                // a failed job may have left its output missing or half written, so nothing after it runs
+                const bool blocked = std::any_of(dependencies[i].begin(), dependencies[i].end(), [&results](size_t j) { return !results[j].ok; });
+                if (waves[i] == wave && !blocked) {
+                    submit_batch_job(pool, jobs[i], hints, results[i]);
+                }
+            }
+            // a job that threw, out of memory most likely, is left failed, the others in its wave still finished
+            try {
+                pool.wait_idle();
+            }
+            catch (const std::exception& exception) {
+                std::cout << "Batch job failed: " << exception.what() << std::endl;
+            }
+        }
+    }
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool all_ok = true;
+    uint64_t total_bytes = 0;
+    std::cout << std::fixed << std::setprecision(1);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const auto& result = results[i];
+        std::cout << (jobs[i].decrypt ? "Decrypted " : "Encrypted ") << jobs[i].input_filename << " To: " << jobs[i].output_filename;
+        if (result.ok) {
+            std::cout << " - " << result.bytes << " bytes in " << result.seconds * 1000 << " ms ("
+                << (result.seconds > 0 ? result.bytes / result.seconds / 1e6 : 0.0) << " MB/s)" << std::endl;
+        }
+        else {
+            std::cout << " - failed" << std::endl;
+        }
+        all_ok = all_ok && result.ok;
+        total_bytes += result.bytes;
+    }
+    std::cout << "Batch: " << jobs.size() << " files, " << total_bytes << " bytes in " << elapsed * 1000 << " ms ("
+        << (elapsed > 0 ? total_bytes / elapsed / 1e6 : 0.0) << " MB/s)" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+    return all_ok;
+}
+
+/// <summary>
+/// drop a file's pages from the os cache so the next access has to go to the disk
+/// </summary>
+/// <returns>false where the os does not let us, the cold benchmarks are skipped then</returns>
+bool drop_file_cache(const std::string& filename)
+{
+#if defined(_WIN32)
+    (void)filename;
+    return false;
+#else
+    const int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    // dirty pages cannot be dropped, so write them back first
+    fdatasync(fd);
+    const bool dropped = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return dropped;
+#endif
+}
+
+/// <summary>
+/// current time stamp counter, 0 where there is none
+/// </summary>
+inline uint64_t read_cycle_counter()
+{
+#if ENCRYPTION_X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/// <summary>
+/// one measured benchmark case
+/// </summary>
+struct benchmark_result
+{
+    std::string name;
+    std::string variant;
+    uint64_t bytes = 0;
+    size_t key_length = 0;
+    double bytes_per_second = 0;
+    // time stamp counter (reference) cycles per byte, 0 where there is no counter
+    double cycles_per_byte = 0;
+};
+
+/// <summary>
+/// time a run repeatedly until enough time has passed to trust the result
+/// </summary>
+/// <param name="bytes">bytes one run processes</param>
+/// <param name="run">the work to time</param>
+/// <param name="prepare">untimed work before every run, such as dropping the cache</param>
+/// <param name="result">receives bytes per second and cycles per byte</param>
+void measure_throughput(uint64_t bytes, const std::function<void()>& run, const std::function<void()>& prepare, benchmark_result& result)
+{
+    using clock = std::chrono::steady_clock;
+    const auto minimum = std::chrono::milliseconds(200);
+
+    // one untimed run to fault in the pages and warm the caches
+    if (prepare)
+    {
+        prepare();
+    }
+    run();
+
+    // small runs are timed in batches of about a megabyte so reading the clock does not swamp them,
+    // runs that need preparing are timed one at a time so the preparation stays out of the measurement
+    const uint64_t batch = prepare ? 1 : std::max<uint64_t>(1, (uint64_t(1) << 20) / std::max<uint64_t>(bytes, 1));
+
+    uint64_t runs = 0;
+    uint64_t cycles = 0;
+    auto elapsed = clock::duration::zero();
+    do
+    {
+        if (prepare)
+        {
+            prepare();
+        }
+        const auto start = clock::now();
+        const uint64_t start_cycles = read_cycle_counter();
+        for (uint64_t i = 0; i < batch; ++i)
+        {
+            run();
+        }
+        cycles += read_cycle_counter() - start_cycles;
+        elapsed += clock::now() - start;
+        runs += batch;
+    } while (elapsed < minimum);
+
+    const double total_bytes = static_cast<double>(bytes) * runs;
+    result.bytes = bytes;
+    result.bytes_per_second = total_bytes / std::chrono::duration<double>(elapsed).count();
+    result.cycles_per_byte = cycles / total_bytes;
+}
+
+/// <summary>
+/// runs the benchmark cases, prints each one as it finishes and keeps them for the json report
+/// </summary>
+class benchmark_suite
+{
+public:
+    /// <summary>
+    /// measure one case and record it
+    /// </summary>
+    /// <returns>the measured result</returns>
+    const benchmark_result& measure(const std::string& name, const std::string& variant, uint64_t bytes, size_t key_length,
+        const std::function<void()>& run, const std::function<void()>& prepare = {})
+    {
+        benchmark_result result;
+        result.name = name;
+        result.variant = variant;
+        result.key_length = key_length;
+        measure_throughput(bytes, run, prepare, result);
+
+        std::cout << std::left << std::setw(18) << name << std::setw(16) << variant << std::right << std::setw(12) << bytes << " bytes";
+        if (key_length > 0)
+        {
+            std::cout << "  key " << std::setw(3) << key_length;
+        }
+        else
+        {
+            std::cout << "         ";
+        }
+        std::cout << std::fixed << std::setprecision(1) << std::setw(12) << result.bytes_per_second / 1e6 << " MB/s"
+            << std::setprecision(3) << std::setw(10) << result.cycles_per_byte << " cycles/byte" << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+
+        results.push_back(result);
+        return results.back();
+    }
+
+    /// <summary>
+    /// write every result as json
+    /// </summary>
+    /// <returns>false if the file could not be written</returns>
+    bool write_json(const std::string& filename, size_t thread_count) const
+    {
+        std::ofstream output_file(filename);
+        output_file << "{\n  \"simd\": \"" << simd_level_name(active_simd_level) << "\",\n"
+            << "  \"threads\": " << thread_count << ",\n  \"results\": [\n";
+        output_file << std::setprecision(6);
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const auto& result = results[i];
+            // names and variants are our own identifiers, nothing in them needs escaping
+            output_file << "    { \"name\": \"" << result.name << "\", \"variant\": \"" << result.variant << "\", \"bytes\": " << result.bytes
+                << ", \"key_length\": " << result.key_length << ", \"bytes_per_second\": " << result.bytes_per_second
+                << ", \"cycles_per_byte\": " << result.cycles_per_byte << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        output_file << "  ]\n}\n";
+        output_file.close();
+        return static_cast<bool>(output_file);
+    }
+
+private:
+    std::vector<benchmark_result> results;
+};
+
+/// <summary>
+/// benchmark encrypt_decrypt across input sizes and key lengths (scalar, vector and threaded), read_file and save_data_file
+/// with a warm and a cold page cache, and the full round trip main runs. results go to the console and a json file
+/// </summary>
+/// <param name="max_size">largest input to benchmark, buffers of twice this size are allocated</param>
+/// <param name="thread_count">threads for the threaded cases, 0 for one per hardware thread</param>
+/// <param name="json_filename">where to write the json report</param>
+/// <returns>false if the report could not be written</returns>
+bool run_benchmark_suite(size_t max_size, size_t thread_count, const std::string& json_filename)
+{
+    benchmark_suite suite;
+    thread_pool pool(thread_count);
+
+    std::vector<char> source(max_size);
+    std::vector<char> destination(max_size);
+    for (size_t i = 0; i < max_size; ++i)
+    {
+        source[i] = static_cast<char>(i * 31 + 7);
+    }
+
+    // checksums go to a volatile so the compiler cannot drop the call
+    volatile uint32_t checksum = 0;
+
+    const auto measure_kernels = [&](size_t size, const std::string& key)
+    {
+        const auto pattern = make_key_pattern(key);
+        const auto general = get_general_xor_kernel(active_simd_level);
+        const std::span<const char> input(source.data(), size);
+        const std::span<char> output(destination.data(), size);
+
+        const double reference = suite.measure("encrypt_decrypt", "scalar", size, key.length(),
+            [&] { xor_scalar(source.data(), destination.data(), size, pattern, 0); }).bytes_per_second;
+        suite.measure("encrypt_decrypt", "vector_general", size, key.length(),
+            [&] { general(source.data(), destination.data(), size, pattern, 0); });
+        const double vector = suite.measure("encrypt_decrypt", "vector", size, key.length(),
+            [&] { encrypt_decrypt(input, output, pattern); }).bytes_per_second;
+        suite.measure("encrypt_decrypt", "threaded", size, key.length(),
+            [&] { encrypt_decrypt_parallel(input, output, pattern, pool); });
+        suite.measure("encrypt_decrypt_crc32c", "separate_pass", size, key.length(),
+            [&] { encrypt_decrypt(input, output, pattern); checksum = crc32c_update(0, output.data(), size); });
+        suite.measure("encrypt_decrypt_crc32c", "fused", size, key.length(),
+            [&] { checksum = encrypt_decrypt_checksummed(input, output, pattern, 0, 0, false); });
+        std::cout << std::fixed << std::setprecision(1) << "  vector is " << vector / reference << "x the scalar loop" << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+    };
+
+    // both crc32c implementations on their own, the table one is what a cpu without sse4.2 gets
+    for (uint64_t size = 64; size <= max_size; size *= 16)
+    {
+        const char* data = source.data();
+        suite.measure("crc32c", "table", static_cast<size_t>(size), 0, [&] { checksum = crc32c_table_update(0, data, static_cast<size_t>(size)); });
+        suite.measure("crc32c", active_crc32c == crc32c_table_update ? "table_active" : "hardware", static_cast<size_t>(size), 0,
+            [&] { checksum = crc32c_update(0, data, static_cast<size_t>(size)); });
+    }
+
+    // input sizes from one cache line up to max_size, with the key main uses
+    for (uint64_t size = 64; size <= max_size; size *= 4)
+    {
+        measure_kernels(static_cast<size_t>(size), "password");
+    }
+
+    // key lengths at a size that is past the caches but quick to run
+    const size_t key_sweep_size = std::min<size_t>(max_size, size_t(16) << 20);
+    for (const size_t key_length : { 1, 2, 3, 4, 7, 8, 13, 16, 31, 32, 64, 100, 128, 255, 256 })
+    {
+        std::string key(key_length, '\0');
+        for (size_t i = 0; i < key_length; ++i)
+        {
+            key[i] = static_cast<char>('a' + i % 26);
+        }
+        measure_kernels(key_sweep_size, key);
+    }
+
+    // many small records with a key each, one std::string encrypt_decrypt call per record against the batch api
+    for (const size_t record_size : { 64, 256, 512 })
+    {
+        const size_t record_count = std::min<size_t>(max_size / record_size, 100000);
+        if (record_count == 0)
+        {
+            break;
+        }
+        std::vector<std::string> records(record_count);
+        std::vector<std::string> record_keys(record_count);
+        std::vector<uint32_t> record_offsets(record_count + 1);
+        std::vector<uint32_t> key_offsets(record_count + 1);
+        std::string keys;
+        for (size_t i = 0; i < record_count; ++i)
+        {
+            records[i].assign(source.data() + i * record_size, record_size);
+            record_keys[i] = "key-" + std::to_string(i);
+            record_offsets[i + 1] = static_cast<uint32_t>((i + 1) * record_size);
+            keys += record_keys[i];
+            key_offsets[i + 1] = static_cast<uint32_t>(keys.length());
+        }
+        const record_batch batch = { std::span<const char>(source.data(), record_count * record_size), record_offsets, keys, key_offsets };
+        const std::span<char> arena(destination.data(), record_count * record_size);
+        const uint64_t total = uint64_t(record_count) * record_size;
+
+        const double per_call = suite.measure("records", "per_call", total, record_size,
+            [&] { for (size_t i = 0; i < record_count; ++i) { destination[i] = encrypt_decrypt(records[i], record_keys[i])[0]; } }).bytes_per_second;
+        const double batched = suite.measure("records", "batch", total, record_size, [&] { encrypt_decrypt_records(batch, arena); }).bytes_per_second;
+        suite.measure("records", "batch_threaded", total, record_size, [&] { encrypt_decrypt_records_parallel(batch, arena, pool); });
+        std::cout << std::fixed << std::setprecision(1) << "  " << record_size << " byte records: " << batched / record_size / 1e6
+            << " M records/s, " << batched / per_call << "x the per call path" << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+    }
+
+    // chacha20 for each instruction set this cpu has and aes-256-ctr, against the xor cipher at the same sizes
+    for (uint64_t size = 64; size <= max_size; size *= 16)
+    {
+        const std::span<const char> input(source.data(), static_cast<size_t>(size));
+        const std::span<char> output(destination.data(), static_cast<size_t>(size));
+        const std::string passphrase = std::string(chacha20_key_prefix) + "password";
+        for (int level = 0; level <= static_cast<int>(active_simd_level); ++level)
+        {
+            const auto pattern = make_key_pattern(passphrase, static_cast<simd_level>(level));
+            suite.measure("chacha20", simd_level_name(static_cast<simd_level>(level)), size, 32, [&] { encrypt_decrypt(input, output, pattern); });
+        }
+        const auto pattern = make_key_pattern(passphrase);
+        suite.measure("chacha20", "threaded", size, 32, [&] { encrypt_decrypt_parallel(input, output, pattern, pool); });
+
+        // aes-256-ctr, the portable constant time aes is slow so it only runs on the smaller sizes
+        const std::string aes_passphrase = std::string(aes256ctr_key_prefix) + "password";
+        if (size <= (uint64_t(1) << 20))
+        {
+            const auto portable = make_key_pattern(aes_passphrase, simd_level::scalar);
+            suite.measure("aes256ctr", "portable", size, 32, [&] { encrypt_decrypt(input, output, portable); });
+        }
+        if (active_aes_ni)
+        {
+            const auto aes_ni = make_key_pattern(aes_passphrase);
+            suite.measure("aes256ctr", "aes-ni", size, 32, [&] { encrypt_decrypt(input, output, aes_ni); });
+            suite.measure("aes256ctr", "threaded", size, 32, [&] { encrypt_decrypt_parallel(input, output, aes_ni, pool); });
+        }
+    }
+
+    // file benchmarks work on a scratch file in the temp directory
+    const size_t file_size = std::min<size_t>(max_size, size_t(256) << 20);
+    const auto scratch = std::filesystem::temp_directory_path();
+    const std::string input_filename = (scratch / "encryption_benchmark_input.txt").string();
+    const std::string encrypted_filename = (scratch / "encryption_benchmark_encrypted.txt").string();
+    const std::string decrypted_filename = (scratch / "encryption_benchmark_decrypted.txt").string();
+    {
+        std::ofstream input_file(input_filename, std::ios::binary);
+        input_file << "Benchmark Student\n";
+        input_file.write(source.data(), static_cast<std::streamsize>(file_size));
+    }
+    const uint64_t input_size = file_size + 18;
+
+    const std::string key = "password";
+    const std::string file_data(source.data(), file_size);
+    const bool can_drop_cache = drop_file_cache(input_filename);
+
+    for (const bool cold : { false, true })
+    {
+        if (cold && !can_drop_cache)
+        {
+            std::cout << "cold cache benchmarks skipped, the page cache cannot be dropped here" << std::endl;
+            break;
+        }
+        const std::string variant = cold ? "cold_cache" : "warm_cache";
+        const auto drop_input = [&] { if (cold) { drop_file_cache(input_filename); } };
+        const auto drop_output = [&] { if (cold) { drop_file_cache(encrypted_filename); } };
+
+        suite.measure("read_file", variant, input_size, 0, [&] { read_file(input_filename); }, drop_input);
+        suite.measure("read_file", variant + "_mapped", input_size, 0, [&] { const mapped_file input_file(input_filename); std::string copy(input_file.view()); }, drop_input);
+        suite.measure("read_file", variant + "_direct", input_size, 0, [&] { read_file(input_filename, { false, true }); }, drop_input);
+        suite.measure("save_data_file", variant, file_size, key.length(),
+            [&] { save_data_file(encrypted_filename, "Benchmark Student", key, file_data); }, drop_output);
+        suite.measure("round_trip", variant, input_size, key.length(),
+            [&] { encrypt_files_in_memory(input_filename, encrypted_filename, decrypted_filename, key, pool, default_chunk_size); }, drop_input);
+        suite.measure("round_trip", variant + "_mapped_output", input_size, key.length(),
+            [&] { encrypt_files_mapped(input_filename, encrypted_filename, decrypted_filename, key, pool, default_chunk_size); }, drop_input);
+    }
+
+    std::error_code ignored;
+    std::filesystem::remove(input_filename, ignored);
+    std::filesystem::remove(encrypted_filename, ignored);
+    std::filesystem::remove(decrypted_filename, ignored);
+
+    if (!suite.write_json(json_filename, pool.size()))
+    {
+        std::cout << "Could not write to file." << std::endl;
+        return false;
+    }
+    std::cout << "Benchmark results written to " << json_filename << std::endl;
+    return true;
+}
+
+/// <summary>
+/// parse a hex string into bytes, for the known answer tests
+/// </summary>
+std::string from_hex(std::string_view hex)
+{
+    std::string bytes(hex.length() / 2, '\0');
+    for (size_t i = 0; i < bytes.length(); ++i)
+    {
+        bytes[i] = static_cast<char>(std::stoi(std::string(hex.substr(2 * i, 2)), nullptr, 16));
+    }
+    return bytes;
+}
+
+/// <summary>
+/// prints a pass or FAIL line for each known answer test and remembers whether they all passed
+/// </summary>
+class self_test_results
+{
+public:
+    void check(const std::string& name, const std::string& actual, const std::string& expected)
+    {
+        const bool ok = actual == expected;
+        std::cout << (ok ? "pass  " : "FAIL  ") << name << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    bool passed() const
+    {
+        return all_passed;
+    }
+
+private:
+    bool all_passed = true;
+};
+
+/// <summary>
+/// check the sse2, avx2 and avx-512 xor kernels this cpu can run against xor_scalar, across key lengths and key phases
+/// </summary>
+void self_test_xor_kernels(self_test_results& results)
+{
+    std::string data(1000, '\0');
+    for (size_t i = 0; i < data.length(); ++i)
+    {
+        data[i] = static_cast<char>(i * 31 + 7);
+    }
+    for (int level = 0; level <= static_cast<int>(active_simd_level); ++level)
+    {
+        bool matched = true;
+        for (size_t key_length = 1; key_length <= 130; ++key_length)
+        {
+            const auto pattern = make_key_pattern(data.substr(500, key_length), static_cast<simd_level>(level));
+            for (const size_t phase : { size_t(0), size_t(1), key_length - 1, size_t(77) })
+            {
+                std::string expected(data.length(), '\0');
+                std::string actual(data.length(), '\0');
+                xor_scalar(data.data(), expected.data(), data.length(), pattern, phase);
+                encrypt_decrypt(data, actual, pattern, phase);
+                matched = matched && actual == expected;
+            }
+        }
+        results.check(std::string("xor kernels ") + simd_level_name(static_cast<simd_level>(level)), matched ? "" : "mismatch", "");
+    }
+}
+
 /// <summary>
-/// encrypt or decrypt a source string using the provided key
+/// check the record batch api against encrypt_decrypt one record at a time, with xor keys of many lengths, runs of repeated
+/// keys and chacha20 and aes-256-ctr keys mixed in, and that a cipher key without a nonce is refused
 /// </summary>
-/// <param name="source">input string to process</param>
-/// <param name="key">key to use in encryption / decryption</param>
-/// <returns>transformed string</returns>
-std::string encrypt_decrypt(const std::string& source, const std::string& key)
+void self_test_records(self_test_results& results)
 {
-    // get lengths now instead of calling the function every time.
-    // this would have most likely been inlined by the compiler, but design for perfomance.
-    const auto key_length = key.length();
-    const auto source_length = source.length();
+    // more records than one task takes, so the parallel version splits them
+    const size_t record_count = records_per_task + 900;
+    std::string data;
+    std::string keys;
+    std::vector<uint32_t> record_offsets(1, 0);
+    std::vector<uint32_t> key_offsets(1, 0);
+    const std::string chacha20_key = add_cipher_nonce("chacha20:records");
+    const std::string aes256ctr_key = add_cipher_nonce("aes256ctr:records");
+    for (size_t i = 0; i < record_count; ++i)
+    {
+        const size_t length = (i * 37) % 300;
+        for (size_t j = 0; j < length; ++j)
+        {
+            data += static_cast<char>(i * 7 + j * 13);
+        }
+        record_offsets.push_back(static_cast<uint32_t>(data.length()));
+        // every fifth record changes key kind, and runs of records share a key so the pattern reuse is exercised
+        switch (i / 3 % 5)
+        {
+        case 3:
+            keys += chacha20_key;
+            break;
+        case 4:
+            keys += aes256ctr_key;
+            break;
+        default:
+            keys += std::string(1 + i / 3 % 70, static_cast<char>('a' + i / 3 % 26));
+            break;
+        }
+        key_offsets.push_back(static_cast<uint32_t>(keys.length()));
+    }
+    const record_batch batch = { data, record_offsets, keys, key_offsets };
 
-    // assert that our input data is good
-    assert(key_length > 0);
-    assert(source_length > 0);
+    std::string expected(data.length(), '\0');
+    for (size_t i = 0; i < record_count; ++i)
+    {
+        const size_t begin = record_offsets[i];
+        const size_t length = record_offsets[i + 1] - begin;
+        encrypt_decrypt(std::span<const char>(data.data() + begin, length), std::span<char>(expected.data() + begin, length), make_key_pattern(record_key(batch, i)));
+    }
 
-    std::string output = source;
+    std::string actual(data.length(), '\0');
+    const bool transformed = encrypt_decrypt_records(batch, actual);
+    results.check("record batch", transformed ? actual : std::string(), expected);
 
-    // loop through the source string char by char
-    for (size_t i = 0; i < source_length; ++i)
-    { // TODO: student need to change the next line from output[i] = source[i]
-      // transform each character based on an xor of the key modded constrained to key length using a mod
-        output[i] = source[i] ^ key[i % key_length];
+    thread_pool pool(4);
+    std::string parallel(data.length(), '\0');
+    const bool parallel_transformed = encrypt_decrypt_records_parallel(batch, parallel, pool);
+    results.check("record batch parallel", parallel_transformed ? parallel : std::string(), expected);
+
+    // a passphrase with no nonce would give every record the same keystream
+    const std::string nonce_less_keys = std::string("abc") + "chacha20:records";
+    const std::vector<uint32_t> nonce_less_offsets = { 0, 3, static_cast<uint32_t>(nonce_less_keys.length()) };
+    const std::vector<uint32_t> nonce_less_record_offsets = { 0, 10, 20 };
+    const record_batch nonce_less = { std::span<const char>(data.data(), 20), nonce_less_record_offsets, nonce_less_keys, nonce_less_offsets };
+    std::string untouched(20, '\0');
+    const bool refused = !encrypt_decrypt_records(nonce_less, untouched);
+    results.check("record batch refuses a cipher key without a nonce", refused && untouched == std::string(20, '\0') ? "" : "accepted", "");
+}
+
+/// <summary>
+/// check that an exception thrown by a parallel_for task comes back out of parallel_for once the other threads are done,
+/// and that the pool still runs loops afterwards
+/// </summary>
+void self_test_thread_pool(self_test_results& results)
+{
+    thread_pool pool(4);
+    std::string caught;
+    try
+    {
+        pool.parallel_for(1000, [&](size_t index)
+        {
+            if (index == 100)
+            {
+                throw std::runtime_error("task 100");
+            }
+        });
     }
+    catch (const std::runtime_error& exception)
+    {
+        caught = exception.what();
+    }
+    results.check("thread pool rethrows a task's exception", caught, "task 100");
 
-    // our output length must equal our source length
-    assert(output.length() == source_length);
+    std::vector<char> ran(1000, 0);
+    pool.parallel_for(ran.size(), [&](size_t index) { ran[index] = 1; });
+    results.check("thread pool runs after an exception", std::find(ran.begin(), ran.end(), 0) == ran.end() ? "" : "missed", "");
+}
 
-    // return the transformed string
-    return output;
+/// <summary>
+/// check that an exception thrown by a work stealing pool task comes back out of wait_idle after the other tasks ran
+/// </summary>
+void self_test_work_stealing_pool(self_test_results& results)
+{
+    work_stealing_pool pool(4);
+    std::atomic<size_t> finished{ 0 };
+    for (size_t index = 0; index < 100; ++index)
+    {
+        pool.submit([index, &finished]
+        {
+            if (index == 10)
+            {
+                throw std::runtime_error("task 10");
+            }
+            finished.fetch_add(1);
+        });
+    }
+    std::string caught;
+    try
+    {
+        pool.wait_idle();
+    }
+    catch (const std::runtime_error& exception)
+    {
+        caught = exception.what();
+    }
+    results.check("work stealing pool rethrows a task's exception", caught, "task 10");
+    results.check("work stealing pool runs the other tasks", finished.load() == 99 ? "" : "missed", "");
 }
 
-std::string read_file(const std::string& filename)
+/// <summary>
+/// check every chacha20 kernel this cpu can run against the rfc 8439 vector, and that a chacha20 key gets and uses its own nonce
+/// </summary>
+void self_test_chacha20(self_test_results& results)
 {
-    try {
-        std::ifstream input_file(filename);
-        std::string file_text = "Raymond Aponte\nThis is my test string.\n";
-        // TODO: implement loading the file into a string
-        if (input_file) {
-            // Implement a new string stream
-            std::ostringstream string_stream;
-            // Reads file buffer to string stream buffer
-            string_stream << input_file.rdbuf();
-            // Outputs buffer to variable file_text
-            file_text = string_stream.str();
-        }
-        // Close the file after use
-        input_file.close();
-        // Return necessary information
-        return file_text;
+    // rfc 8439 2.4.2, the keystream starts at block counter 1
+    {
+        const std::string key = from_hex("000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f");
+        const std::string nonce = from_hex("000000000000004a00000000");
+        const std::string plain_text = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+        const std::string expected = from_hex(
+            "6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0bf91b65c5524733ab8f593dabcd62b357"
+            "1639d624e65152ab8f530c359f0861d807ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab7793736"
+            "5af90bbf74a35be6b40b8eedf2785e42874d");
+        for (int level = 0; level <= static_cast<int>(active_simd_level); ++level)
+        {
+            const auto pattern = make_chacha20_pattern(reinterpret_cast<const uint8_t*>(key.data()), reinterpret_cast<const uint8_t*>(nonce.data()),
+                static_cast<simd_level>(level));
+            std::string cipher_text(plain_text.length(), '\0');
+            encrypt_decrypt(plain_text, cipher_text, pattern, chacha20_block_size);
+            results.check(std::string("chacha20 rfc 8439 2.4.2 ") + simd_level_name(static_cast<simd_level>(level)), cipher_text, expected);
+        }
     }
-    catch (...) {
-        std::cout << "Could not read file." << std::endl;
+
+    // a cipher key gets a fresh nonce per file, the pattern uses it, and a decrypt key without one picks up the stored one
+    {
+        const std::string first = add_cipher_nonce("chacha20:passphrase");
+        const std::string second = add_cipher_nonce("chacha20:passphrase");
+        results.check("cipher keys get distinct nonces", first == second ? "same" : "", "");
+        results.check("cipher key nonce is kept", add_cipher_nonce(first), first);
+        results.check("decrypt key picks up the stored nonce", resolve_cipher_key("chacha20:passphrase", first), first);
+
+        const std::string nonce = from_hex(first.substr(chacha20_key_prefix.length(), cipher_nonce_hex_length));
+        const auto cipher_key = sha256("passphrase");
+        const auto expected_pattern = make_chacha20_pattern(cipher_key.data(), reinterpret_cast<const uint8_t*>(nonce.data()));
+        const std::string plain_text(300, 'p');
+        std::string expected(plain_text.length(), '\0');
+        std::string actual(plain_text.length(), '\0');
+        encrypt_decrypt(plain_text, expected, expected_pattern);
+        encrypt_decrypt(plain_text, actual, make_key_pattern(first));
+        results.check("chacha20 key uses its nonce", actual, expected);
+
+        std::string other(plain_text.length(), '\0');
+        encrypt_decrypt(plain_text, other, make_key_pattern(second));
+        results.check("same passphrase, different keystream", actual == other ? "same" : "", "");
     }
 }
 
-std::string get_student_name(const std::string& string_data)
+/// <summary>
+/// check the portable aes-256 block cipher and every counter mode kernel this cpu can run against the nist vectors
+/// </summary>
+void self_test_aes256ctr(self_test_results& results)
 {
-    std::string student_name;
+    // fips-197 c.3 for the block cipher, sp 800-38a f.5.5 for counter mode
+    {
+        const std::string key = from_hex("000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f");
+        const auto pattern = make_aes256ctr_pattern(reinterpret_cast<const uint8_t*>(key.data()), reinterpret_cast<const uint8_t*>(std::string(16, '\0').data()), false);
+        std::string block = from_hex("00112233445566778899aabbccddeeff");
+        aes256_encrypt_block_portable(pattern.aes_round_keys.data(), reinterpret_cast<unsigned char*>(block.data()));
+        results.check("aes-256 fips-197 c.3 portable", block, from_hex("8ea2b7ca516745bfeafc49904b496089"));
+    }
+    {
+        const std::string key = from_hex("603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4");
+        const std::string initial_counter = from_hex("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff");
+        const std::string plain_text = from_hex(
+            "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e5130c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710");
+        const std::string expected = from_hex(
+            "601ec313775789a5b7a7f504bbf3d228f443e3ca4d62b59aca84e990cacaf5c52b0930daa23de94ce87017ba2d84988ddfc9c58db67aada613c2dd08457941a6");
+        for (const bool use_aes_ni : { false, true })
+        {
+            if (use_aes_ni && !active_aes_ni)
+            {
+                continue;
+            }
+            const auto pattern = make_aes256ctr_pattern(reinterpret_cast<const uint8_t*>(key.data()), reinterpret_cast<const uint8_t*>(initial_counter.data()), use_aes_ni);
+            std::string cipher_text(plain_text.length(), '\0');
+            encrypt_decrypt(plain_text, cipher_text, pattern);
+            results.check(std::string("aes-256-ctr sp 800-38a f.5.5 ") + (use_aes_ni ? "aes-ni" : "portable"), cipher_text, expected);
 
-    // find the first newline
-    size_t pos = string_data.find('\n');
-    // did we find a newline
-    if (pos != std::string::npos)
-    { // we did, so copy that substring as the student name
-        student_name = string_data.substr(0, pos);
+            // a run long enough for the eight block path, starting mid block, against one block at a time
+            const std::string long_text = plain_text + plain_text + plain_text;
+            const auto portable = make_aes256ctr_pattern(reinterpret_cast<const uint8_t*>(key.data()), reinterpret_cast<const uint8_t*>(initial_counter.data()), false);
+            std::string long_cipher_text(long_text.length(), '\0');
+            std::string reference(long_text.length(), '\0');
+            encrypt_decrypt(long_text, long_cipher_text, pattern, 3);
+            for (size_t i = 0; i < long_text.length(); ++i)
+            {
+                xor_aes256ctr_portable(long_text.data() + i, reference.data() + i, 1, portable, 3 + i);
+            }
+            results.check(std::string("aes-256-ctr long unaligned run ") + (use_aes_ni ? "aes-ni" : "portable"), long_cipher_text, reference);
+        }
     }
+}
 
-    return student_name;
+/// <summary>
+/// check sha-256 and the hmac built on it against the published vectors
+/// </summary>
+void self_test_sha256(self_test_results& results)
+{
+    // fips 180-4 over several blocks, and rfc 4231 test case 2 for the hmac the incremental manifest uses
+    const auto as_string = [](const std::array<uint8_t, 32>& digest) { return std::string(digest.begin(), digest.end()); };
+    results.check("sha-256 multi block", as_string(sha256(std::string(1000, 'a'))),
+        from_hex("41edece42d63e8d9bf515a9ba6932e1c20cbc9f5a5d134645adb5db1b9737ea3"));
+    results.check("hmac-sha-256 rfc 4231 2", as_string(hmac_sha256("Jefe", "what do ya want for nothing?")),
+        from_hex("5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"));
 }
 
-void save_data_file(const std::string& filename, const std::string& student_name, const std::string& key, const std::string& data)
+/// <summary>
+/// check that the encrypting and decrypting streambufs produce what encrypt_decrypt does however the stream is cut up
+/// </summary>
+void self_test_streambufs(self_test_results& results)
 {
-    struct tm ltm;
-    // Char buffer to store formatted time
-    char time_buf[80];
-    // Need localized time for this method
-    time_t now = time(0);
-    localtime_s(&ltm, &now);
-    // Formats the date as required
-    strftime(time_buf, sizeof(time_buf), "%Y-%m-%d", &ltm);
+    // single characters, small writes and writes larger than the buffer are mixed so the key phase has to carry across
+    // every kind of boundary
+    std::string data(5000, '\0');
+    for (size_t i = 0; i < data.length(); ++i)
+    {
+        data[i] = static_cast<char>(i * 13 + 5);
+    }
+    const auto pattern = make_key_pattern("streambuf key");
+    std::string expected(data.length(), '\0');
+    encrypt_decrypt(data, expected, pattern, 4);
 
-    try {
-        //  TODO: implement file saving
-        std::ofstream output_file(filename);
-        //  Line 1: student name
-        output_file << student_name << "\n";
-        //  Line 2: timestamp (yyyy-mm-dd)
-        output_file << time_buf << "\n";
-        //  Line 3: key used
-        output_file << key << "\n";
-        //  Line 4+: data
-        output_file << data;
+    std::stringbuf encrypted;
+    {
+        encrypting_streambuf encrypting(encrypted, pattern, 100, 4);
+        std::ostream output(&encrypting);
+        size_t offset = 0;
+        for (const size_t length : { size_t(1), size_t(7), size_t(1), size_t(250), size_t(99), size_t(1), size_t(1), size_t(1000) })
+        {
+            if (length == 1)
+            {
+                output.put(data[offset]);
+            }
+            else
+            {
+                output.write(data.data() + offset, static_cast<std::streamsize>(length));
+            }
+            offset += length;
+        }
+        output.flush();
+        output.write(data.data() + offset, static_cast<std::streamsize>(data.length() - offset));
+    }
+    results.check("encrypting_streambuf", encrypted.str(), expected);
 
-        output_file.close();
+    decrypting_streambuf decrypting(encrypted, pattern, 100, 4);
+    std::istream input(&decrypting);
+    std::string decrypted(data.length(), '\0');
+    size_t offset = 0;
+    for (const size_t length : { size_t(1), size_t(30), size_t(1), size_t(300), size_t(99), size_t(3) })
+    {
+        input.read(decrypted.data() + offset, static_cast<std::streamsize>(length));
+        offset += length;
+    }
+    input.read(decrypted.data() + offset, static_cast<std::streamsize>(data.length() - offset));
+    results.check("decrypting_streambuf", input.gcount() == static_cast<std::streamsize>(data.length() - offset) ? decrypted : std::string(), data);
+}
+
+/// <summary>
+/// a scratch file in the temp directory for the self tests that need a file, the same place the benchmark writes its files
+/// </summary>
+std::string self_test_filename(const std::string& name)
+{
+    return (std::filesystem::temp_directory_path() / ("encryption_self_test_" + name)).string();
+}
+
+/// <summary>
+/// check that the streaming mode gives the same data as encrypting the whole input at once, with block sizes that put the
+/// key phase somewhere different at every block boundary, and that streaming the result back decrypts it
+/// </summary>
+void self_test_streaming(self_test_results& results)
+{
+    std::string input = "Self Test\n";
+    for (size_t i = 0; i < 5000; ++i)
+    {
+        input += static_cast<char>(i * 17 + 11);
+    }
+    const std::string input_filename = self_test_filename("stream_input.txt");
+    const std::string encrypted_filename = self_test_filename("stream_encrypted.txt");
+    const std::string decrypted_filename = self_test_filename("stream_decrypted.txt");
+    {
+        std::ofstream input_file(input_filename, std::ios::binary);
+        input_file.write(input.data(), static_cast<std::streamsize>(input.length()));
+    }
+
+    for (const std::string& key : { std::string("phase key"), add_cipher_nonce("chacha20:phase key") })
+    {
+        std::string expected(input.length(), '\0');
+        encrypt_decrypt(input, expected, make_key_pattern(key));
+        for (const size_t block_size : { size_t(1), size_t(7), size_t(64), size_t(1000) })
+        {
+            const std::string name = std::string(key.starts_with(chacha20_key_prefix) ? "chacha20" : "xor") + " block size " + std::to_string(block_size);
+            std::string student_name;
+            std::string_view data;
+            std::string encrypted;
+            if (stream_data_file(input_filename, encrypted_filename, key, block_size, false))
+            {
+                encrypted = read_file(encrypted_filename);
+            }
+            results.check("stream encrypt " + name, split_data_file(encrypted, student_name, data) ? std::string(data) : std::string(), expected);
+
+            std::string decrypted;
+            if (stream_data_file(encrypted_filename, decrypted_filename, key, block_size, true))
+            {
+                decrypted = read_file(decrypted_filename);
+            }
+            results.check("stream decrypt " + name, split_data_file(decrypted, student_name, data) ? std::string(data) : std::string(), input);
+        }
+    }
+
+    for (const auto& filename : { input_filename, encrypted_filename, decrypted_filename })
+    {
+        std::filesystem::remove(filename);
+    }
+}
+
+/// <summary>
+/// check that verify_round_trip passes a good encryption and reports the exact offset of a bad byte, in the first block, past
+/// several blocks, and when the lengths differ
+/// </summary>
+void self_test_verify_round_trip(self_test_results& results)
+{
+    std::string source(3 * verify_block_size + 123, '\0');
+    for (size_t i = 0; i < source.length(); ++i)
+    {
+        source[i] = static_cast<char>(i * 41 + 9);
+    }
+    const auto pattern = make_key_pattern("verify key");
+    std::string encrypted(source.length(), '\0');
+    encrypt_decrypt(source, encrypted, pattern);
+    results.check("round trip verified", verify_round_trip(source, encrypted, pattern) == std::string::npos ? "" : "mismatch", "");
+
+    for (const size_t offset : { size_t(0), size_t(5), 2 * verify_block_size + 77, source.length() - 1 })
+    {
+        std::string damaged = encrypted;
+        damaged[offset] ^= 0x10;
+        results.check("round trip mismatch at " + std::to_string(offset), std::to_string(verify_round_trip(source, damaged, pattern)), std::to_string(offset));
+    }
+
+    const std::span<const char> shorter(encrypted.data(), encrypted.length() - 10);
+    results.check("round trip mismatch at the shorter length", std::to_string(verify_round_trip(source, shorter, pattern)), std::to_string(shorter.size()));
+}
+
+/// <summary>
+/// check that encrypt_decrypt_checksummed gives the same bytes and crc as encrypt_decrypt followed by a separate crc32c pass,
+/// summing the output when encrypting and the source when decrypting, over lengths that end inside and past a crc block
+/// </summary>
+void self_test_checksummed(self_test_results& results)
+{
+    std::string source(2 * checksum_block_size + 1000, '\0');
+    for (size_t i = 0; i < source.length(); ++i)
+    {
+        source[i] = static_cast<char>(i * 19 + 1);
+    }
+    // the check value every crc-32c implementation publishes
+    results.check("crc32c check value", std::to_string(crc32c_update(0, "123456789", 9)), std::to_string(0xe3069283u));
+
+    for (const std::string& key : { std::string("crc key"), add_cipher_nonce("chacha20:crc key") })
+    {
+        const auto pattern = make_key_pattern(key);
+        for (const size_t length : { size_t(0), size_t(1), size_t(100), checksum_block_size, source.length() })
+        {
+            const std::span<const char> input(source.data(), length);
+            const std::string name = std::string(key.starts_with(chacha20_key_prefix) ? "chacha20" : "xor") + " length " + std::to_string(length);
+            std::string expected(length, '\0');
+            encrypt_decrypt(input, expected, pattern, 5);
+
+            // encrypting sums what it writes, carrying on from an earlier crc
+            std::string actual(length, '\0');
+            const uint32_t crc = encrypt_decrypt_checksummed(input, actual, pattern, 5, 0x1234, false);
+            results.check("checksummed encrypt " + name, actual, expected);
+            results.check("checksummed encrypt crc " + name, std::to_string(crc), std::to_string(crc32c_update(0x1234, expected.data(), length)));
+
+            // decrypting sums what it reads
+            const uint32_t source_crc = encrypt_decrypt_checksummed(input, actual, pattern, 5, 0, true);
+            results.check("checksummed decrypt crc " + name, std::to_string(source_crc), std::to_string(crc32c_update(0, input.data(), length)));
+        }
+    }
+}
+
+/// <summary>
+/// check that the pipelined mode writes the same file data as the serial streaming mode, with one block in flight (every
+/// stage waits on the one before) and with several, and that a pipelined decrypt gives the input back
+/// </summary>
+void self_test_pipeline(self_test_results& results)
+{
+    std::string input = "Self Test\n";
+    for (size_t i = 0; i < 20000; ++i)
+    {
+        input += static_cast<char>(i * 23 + 13);
+    }
+    const std::string input_filename = self_test_filename("pipeline_input.txt");
+    const std::string serial_filename = self_test_filename("pipeline_serial.txt");
+    const std::string encrypted_filename = self_test_filename("pipeline_encrypted.txt");
+    const std::string decrypted_filename = self_test_filename("pipeline_decrypted.txt");
+    {
+        std::ofstream input_file(input_filename, std::ios::binary);
+        input_file.write(input.data(), static_cast<std::streamsize>(input.length()));
+    }
+
+    // the data after the header, the date line may differ between the two runs
+    const auto file_data = [](const std::string& filename)
+    {
+        std::string student_name;
+        std::string_view data;
+        const std::string contents = read_file(filename);
+        return split_data_file(contents, student_name, data) ? std::string(data) : std::string();
+    };
+
+    const std::string key = "pipeline key";
+    const std::string serial = stream_data_file(input_filename, serial_filename, key, 1000, false) ? file_data(serial_filename) : std::string();
+    for (const size_t block_count : { size_t(1), size_t(2), size_t(8) })
+    {
+        pipeline_timings timings;
+        const std::string name = "block count " + std::to_string(block_count);
+        const bool encrypted = pipeline_data_file(input_filename, encrypted_filename, key, 1000, block_count, false, timings);
+        results.check("pipeline matches serial " + name, encrypted && !serial.empty() ? file_data(encrypted_filename) : std::string("failed"), serial);
+        const bool decrypted = pipeline_data_file(encrypted_filename, decrypted_filename, key, 777, block_count, true, timings);
+        results.check("pipeline decrypt " + name, decrypted ? file_data(decrypted_filename) : std::string(), input);
+    }
+
+    for (const auto& filename : { input_filename, serial_filename, encrypted_filename, decrypted_filename })
+    {
+        std::filesystem::remove(filename);
+    }
+}
+
+/// <summary>
+/// check that decrypt_range gives the same bytes as the matching slice of a full decrypt, for ranges that start at a non zero
+/// key phase, cross v2 chunk boundaries or run past the end, in both file formats and with an xor and a chacha20 key
+/// </summary>
+void self_test_decrypt_range(self_test_results& results)
+{
+    std::string plain_text(5500, '\0');
+    for (size_t i = 0; i < plain_text.length(); ++i)
+    {
+        plain_text[i] = static_cast<char>(i * 37 + 5);
+    }
+    const std::string filename = self_test_filename("range.dat");
+    thread_pool pool(2);
+
+    for (const std::string& key : { std::string("seven!!"), add_cipher_nonce("chacha20:range key") })
+    {
+        std::string encrypted(plain_text.length(), '\0');
+        encrypt_decrypt(plain_text, encrypted, make_key_pattern(key));
+        for (const bool v2 : { false, true })
+        {
+            if (v2)
+            {
+                save_data_file_v2(filename, "Self Test", key, encrypted, 1000);
+            }
+            else
+            {
+                save_data_file(filename, "Self Test", key, encrypted);
+            }
+            const std::string name = std::string(key.starts_with(chacha20_key_prefix) ? "chacha20" : "xor") + (v2 ? " v2" : " text");
+            data_file_header header;
+            std::string full;
+            if (!load_data_file(filename, std::string(), pool, header, full) || full != plain_text)
+            {
+                results.check("range full decrypt " + name, "failed", "");
+                continue;
+            }
+
+            const std::pair<uint64_t, size_t> ranges[] = { { 0, 10 }, { 3, 64 }, { 999, 2 }, { 1001, 2500 }, { 5400, 1000 }, { 5500, 10 } };
+            for (const auto& [offset, length] : ranges)
+            {
+                std::string slice;
+                const bool read = decrypt_range(filename, offset, length, std::string(), slice);
+                const std::string expected = offset < full.length() ? full.substr(static_cast<size_t>(offset), length) : std::string();
+                results.check("range " + name + " at " + std::to_string(offset) + " for " + std::to_string(length), read ? slice : std::string("failed"), expected);
+            }
+        }
+    }
+    std::filesystem::remove(filename);
+}
+
+/// <summary>
+/// check that the v2 parser accepts a file save_data_file_v2 wrote and rejects a truncated header, a chunk count too large for
+/// the header, and a header whose crc does not match, and that a corrupted chunk is caught by its crc
+/// </summary>
+void self_test_data_file_v2(self_test_results& results)
+{
+    std::string plain_text(10000, '\0');
+    for (size_t i = 0; i < plain_text.length(); ++i)
+    {
+        plain_text[i] = static_cast<char>(i * 29 + 3);
+    }
+    const auto pattern = make_key_pattern("container key");
+    std::string encrypted(plain_text.length(), '\0');
+    encrypt_decrypt(plain_text, encrypted, pattern);
+    const std::string filename = self_test_filename("v2.dat");
+    if (!save_data_file_v2(filename, "Self Test", "container key", encrypted, 1000))
+    {
+        results.check("v2 container written", "not written", "");
+        return;
+    }
+    const std::string file_data = read_file(filename);
+    std::filesystem::remove(filename);
+
+    data_file_v2_layout layout;
+    const bool parsed = parse_data_file_v2(file_data, file_data.length(), layout);
+    results.check("v2 header parses", parsed && layout.chunks.size() == 10 && layout.header.student_name == "Self Test" ? "" : "rejected", "");
+    if (!parsed)
+    {
+        return;
+    }
+
+    // a header edited after the fact gets a fresh crc, so only the field being tested is wrong
+    const auto reseal = [](std::string header)
+    {
+        const uint32_t header_size = get_u32(header.data() + 12);
+        put_u32(&header[60], 0);
+        put_u32(&header[60], crc32c_update(0, header.data(), header_size));
+        return header;
+    };
+    const auto rejected = [](std::string_view bytes, uint64_t file_size)
+    {
+        data_file_v2_layout unused;
+        return parse_data_file_v2(bytes, file_size, unused) ? "accepted" : "";
+    };
+    results.check("v2 truncated header rejected", rejected(std::string_view(file_data).substr(0, 100), 100), "");
+
+    std::string oversized = file_data;
+    put_u64(&oversized[40], uint64_t(1) << 60);
+    results.check("v2 oversized chunk count rejected", rejected(reseal(oversized), oversized.length()), "");
+    std::string miscounted = file_data;
+    put_u64(&miscounted[40], 9);
+    results.check("v2 chunk count that does not fit the header rejected", rejected(reseal(miscounted), miscounted.length()), "");
+
+    std::string bad_crc = file_data;
+    bad_crc[data_file_v2_fixed_size] ^= 1;
+    results.check("v2 header with a bad crc rejected", rejected(bad_crc, bad_crc.length()), "");
+
+    // the payload is not covered by the header crc, a flipped byte shows up as its chunk failing
+    thread_pool pool(2);
+    std::string decrypted(plain_text.length(), '\0');
+    const size_t intact = decrypt_data_file_v2(file_data, layout, pattern, decrypted, pool);
+    results.check("v2 chunks decrypt", intact == layout.chunks.size() ? decrypted : std::string(), plain_text);
+
+    std::string corrupted = file_data;
+    corrupted[static_cast<size_t>(layout.chunks[3].offset) + 17] ^= 0x40;
+    results.check("v2 corrupted chunk found while decrypting", std::to_string(decrypt_data_file_v2(corrupted, layout, pattern, decrypted, pool)), "3");
+    results.check("v2 corrupted chunk found without the key", std::to_string(check_data_file_v2(corrupted, layout)), "3");
+}
+
+/// <summary>
+/// run every self test: the cipher kernels this cpu can run against published test vectors, the xor kernels against the
+/// reference loop, sha-256 and the streambufs
+/// </summary>
+/// <returns>true if every check passed</returns>
+bool run_self_test()
+{
+    self_test_results results;
+    self_test_xor_kernels(results);
+    self_test_records(results);
+    self_test_thread_pool(results);
+    self_test_work_stealing_pool(results);
+    self_test_streaming(results);
+    self_test_verify_round_trip(results);
+    self_test_decrypt_range(results);
+    self_test_data_file_v2(results);
+    self_test_checksummed(results);
+    self_test_pipeline(results);
+    self_test_chacha20(results);
+    self_test_aes256ctr(results);
+    self_test_sha256(results);
+    self_test_streambufs(results);
+
+    std::cout << (results.passed() ? "all self tests passed" : "self tests FAILED") << std::endl;
+    return results.passed();
+}
+
+/// <summary>
+/// command line switches, the defaults reproduce the original single in-memory run
+/// </summary>
+struct program_options
+{
+    // check the encrypted data decrypts back to the input instead of writing the decrypted file
+    bool verify = false;
+    // stream the files block by block instead of loading them whole
+    bool stream = false;
+    // stream with several reads and writes in flight at once
+    bool async = false;
+    // stream with reading, transforming and writing on their own threads
+    bool pipeline = false;
+    // rewrite only the chunks of the encrypted file whose plain text changed since the last run
+    bool incremental = false;
+    // blocks in flight in the async and pipeline modes
+    size_t queue_depth = 8;
+    // let the async mode use io_uring, otherwise it uses io threads
+    bool allow_uring = true;
+    // block size for the streaming modes
+    size_t block_size = default_block_size;
+    // threads for the in-memory mode, 0 for one per hardware thread
+    size_t threads = 0;
+    // bytes each thread transforms at a time
+    size_t chunk_size = default_chunk_size;
+    // run every job in this manifest instead of the three fixed files
+    std::string batch_manifest;
+    // list the data files under this directory instead of encrypting anything
+    std::string list_directory;
+    // decrypt one byte range of this data file to standard output
+    std::string range_file;
+    uint64_t range_offset = 0;
+    size_t range_length = 0;
+    // time the xor kernels instead of encrypting the files
+    bool benchmark = false;
+    // largest input the benchmark transforms, --benchmark-size 4g runs the full 64 bytes to 4 gigabytes sweep but needs
+    // two buffers of that size, so the default stops where a run fits on any machine and finishes in seconds
+    size_t benchmark_size = size_t(64) << 20;
+    // where the benchmark writes its json report
+    std::string benchmark_output = "benchmark.json";
+    // where to write the per stage timings when the run ends, empty for nowhere
+    std::string stats_output;
+    // how the in-memory and batch modes read their inputs
+    file_read_hints read_hints;
+    // write the in-memory mode's outputs through writable mappings instead of write calls
+    bool mapped_output = false;
+    // write the encrypted file in the binary v2 container instead of the text format
+    bool container_v2 = false;
+    // bytes per checksummed chunk of the v2 container and the incremental manifest, 0 for the mode's own default
+    size_t container_chunk_size = 0;
+    // prefix of the key for the fixed files, empty for the repeating key xor
+    std::string cipher_prefix;
+    // check the ciphers against known answers
+    bool self_test = false;
+    // key for the fixed files and the pipe mode, empty for "password" (or the header's key when decrypting a pipe)
+    std::string key;
+    // encrypt or decrypt standard input to standard output
+    bool pipe = false;
+    bool pipe_decrypt = false;
+    // student name for the header the pipe mode writes, empty for the first line of the input
+    std::string student_name;
+    // decrypt this data file, in either format, to decrypt_output
+    std::string decrypt_input;
+    std::string decrypt_output;
+};
+
+/// <summary>
+/// parse a byte count with an optional k, m or g suffix
+/// </summary>
+/// <param name="text">text to parse</param>
+/// <param name="value">parsed value</param>
+/// <returns>true if the whole text was a valid size</returns>
+bool parse_size(const std::string& text, size_t& value)
+{
+    try {
+        size_t used = 0;
+        const unsigned long long number = std::stoull(text, &used);
+        unsigned long long multiplier = 1;
+        if (used + 1 == text.length()) {
+            switch (text[used]) {
+            case 'k': case 'K': multiplier = 1ull << 10; break;
+            case 'm': case 'M': multiplier = 1ull << 20; break;
+            case 'g': case 'G': multiplier = 1ull << 30; break;
+            default: return false;
+            }
+        }
+        else if (used != text.length()) {
+            return false;
+        }
+        value = static_cast<size_t>(number * multiplier);
+        return true;
     }
     catch (...) {
-        std::cout << "Could not write to file." << std::endl;
+        return false;
+    }
+}
+
+/// <summary>
+/// read the command line into options
+/// </summary>
+/// <returns>false if the command line was not understood</returns>
+bool parse_options(int argc, char* argv[], program_options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string argument = argv[i];
+        if (argument == "--stream")
+        {
+            options.stream = true;
+        }
+        else if (argument == "--verify")
+        {
+            options.verify = true;
+        }
+        else if (argument == "--async")
+        {
+            options.async = true;
+        }
+        else if (argument == "--pipeline")
+        {
+            options.pipeline = true;
+        }
+        else if (argument == "--incremental")
+        {
+            options.incremental = true;
+        }
+        else if (argument == "--queue-depth" && i + 1 < argc)
+        {
+            if (!parse_size(argv[++i], options.queue_depth) || options.queue_depth == 0)
+            {
+                return false;
+            }
+        }
+        else if (argument == "--io-engine" && i + 1 < argc)
+        {
+            const std::string engine = argv[++i];
+            if (engine != "uring" && engine != "threads")
+            {
+                return false;
+            }
+            options.allow_uring = engine == "uring";
+        }
+        else if (argument == "--block-size" && i + 1 < argc)
+        {
+            if (!parse_size(argv[++i], options.block_size) || options.block_size == 0)
+            {
+                return false;
+            }
+        }
+        else if (argument == "--decrypt-range" && i + 3 < argc)
+        {
+            options.range_file = argv[++i];
+            size_t offset = 0;
+            if (!parse_size(argv[++i], offset) || !parse_size(argv[++i], options.range_length))
+            {
+                return false;
+            }
+            options.range_offset = offset;
+        }
+        else if (argument == "--batch" && i + 1 < argc)
+        {
+            options.batch_manifest = argv[++i];
+        }
+        else if (argument == "--list" && i + 1 < argc)
+        {
+            options.list_directory = argv[++i];
+        }
+        else if (argument == "--pipe" && i + 1 < argc)
+        {
+            const std::string direction = argv[++i];
+            if (direction != "encrypt" && direction != "decrypt")
+            {
+                return false;
+            }
+            options.pipe = true;
+            options.pipe_decrypt = direction == "decrypt";
+        }
+        else if (argument == "--key" && i + 1 < argc)
+        {
+            options.key = argv[++i];
+            if (options.key.empty())
+            {
+                return false;
+            }
+        }
+        else if (argument == "--name" && i + 1 < argc)
+        {
+            options.student_name = argv[++i];
+        }
+        else if (argument == "--drop-cache")
+        {
+            options.read_hints.drop_cache = true;
+        }
+        else if (argument == "--direct-io")
+        {
+            options.read_hints.direct = true;
+        }
+        else if (argument == "--mapped-output")
+        {
+            options.mapped_output = true;
+        }
+        else if (argument == "--stats" && i + 1 < argc)
+        {
+            options.stats_output = argv[++i];
+        }
+        else if (argument == "--self-test")
+        {
+            options.self_test = true;
+        }
+        else if (argument == "--benchmark")
+        {
+            options.benchmark = true;
+        }
+        else if (argument == "--benchmark-size" && i + 1 < argc)
+        {
+            if (!parse_size(argv[++i], options.benchmark_size) || options.benchmark_size == 0)
+            {
+                return false;
+            }
+        }
+        else if (argument == "--benchmark-output" && i + 1 < argc)
+        {
+            options.benchmark_output = argv[++i];
+        }
+        else if (argument == "--format" && i + 1 < argc)
+        {
+            const std::string format = argv[++i];
+            if (format != "text" && format != "v2")
+            {
+                return false;
+            }
+            options.container_v2 = format == "v2";
+        }
+        else if (argument == "--cipher" && i + 1 < argc)
+        {
+            const std::string cipher = argv[++i];
+            if (cipher == "chacha20")
+            {
+                options.cipher_prefix = chacha20_key_prefix;
+            }
+            else if (cipher == "aes256ctr")
+            {
+                options.cipher_prefix = aes256ctr_key_prefix;
+            }
+            else if (cipher != "xor")
+            {
+                return false;
+            }
+        }
+        else if (argument == "--container-chunk" && i + 1 < argc)
+        {
+            if (!parse_size(argv[++i], options.container_chunk_size) || options.container_chunk_size == 0 || options.container_chunk_size > UINT32_MAX)
+            {
+                return false;
+            }
+        }
+        else if (argument == "--decrypt-file" && i + 2 < argc)
+        {
+            options.decrypt_input = argv[++i];
+            options.decrypt_output = argv[++i];
+        }
+        else if (argument == "--threads" && i + 1 < argc)
+        {
+            if (!parse_size(argv[++i], options.threads))
+            {
+                return false;
+            }
+        }
+        else if (argument == "--chunk-size" && i + 1 < argc)
+        {
+            if (!parse_size(argv[++i], options.chunk_size) || options.chunk_size == 0)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
     }
+    return true;
+}
+
+void print_usage()
+{
+    // the modes, one per line, then the options several modes share, then what a key can look like
+    std::cout << "usage: AponteEncryptionActivity [--stream] [--block-size <bytes>[k|m|g]] [--threads <count>] [--chunk-size <bytes>[k|m|g]] [--drop-cache] [--direct-io]" << std::endl;
+    std::cout << "       AponteEncryptionActivity --mapped-output [--threads <count>] [--chunk-size <bytes>[k|m|g]]" << std::endl;
+    std::cout << "       AponteEncryptionActivity --verify [--threads <count>] [--chunk-size <bytes>[k|m|g]]" << std::endl;
+    std::cout << "       AponteEncryptionActivity --pipeline [--queue-depth <count>] [--block-size <bytes>[k|m|g]]" << std::endl;
+    std::cout << "       AponteEncryptionActivity --async [--queue-depth <count>] [--io-engine uring|threads] [--block-size <bytes>[k|m|g]]" << std::endl;
+    std::cout << "       AponteEncryptionActivity --format v2 [--container-chunk <bytes>[k|m|g]] [--threads <count>]" << std::endl;
+    std::cout << "       AponteEncryptionActivity --incremental [--container-chunk <bytes>[k|m|g]] [--threads <count>]" << std::endl;
+    std::cout << "       AponteEncryptionActivity --decrypt-file <data file> <output file> [--key <key>] [--cipher xor|chacha20|aes256ctr] [--threads <count>]" << std::endl;
+    std::cout << "       AponteEncryptionActivity --decrypt-range <data file> <offset> <length> [--key <key>] [--cipher xor|chacha20|aes256ctr]" << std::endl;
+    std::cout << "       AponteEncryptionActivity --pipe encrypt|decrypt [--key <key>] [--cipher xor|chacha20|aes256ctr] [--name <student name>] [--block-size <bytes>[k|m|g]] < input > output" << std::endl;
+    std::cout << "       AponteEncryptionActivity --list <directory> [--threads <count>]" << std::endl;
+    std::cout << "       AponteEncryptionActivity --batch <manifest> [--threads <count>] [--drop-cache] [--direct-io]" << std::endl;
+    std::cout << "       AponteEncryptionActivity --benchmark [--benchmark-size <bytes>[k|m|g]] [--benchmark-output <json file>] [--threads <count>]" << std::endl;
+    std::cout << "       AponteEncryptionActivity --self-test" << std::endl;
+    std::cout << std::endl;
+    std::cout << "options: any mode that encrypts the fixed files also takes [--key <key>] and [--cipher xor|chacha20|aes256ctr]" << std::endl;
+    std::cout << "         the decrypt modes use the key stored in the file unless --key is given" << std::endl;
+    std::cout << "         any mode also takes [--stats <json file>] for per stage timings" << std::endl;
+    std::cout << "         --container-chunk defaults to 1m for --format v2 and 4k for --incremental" << std::endl;
+    std::cout << "         --incremental only takes xor keys, rewriting chunks under a cipher's nonce would reuse its keystream" << std::endl;
+    std::cout << "         --benchmark-size defaults to 64m, --benchmark-size 4g sweeps 64 bytes to 4g but allocates twice that" << std::endl;
+    std::cout << std::endl;
+    std::cout << "keys:    <key>                                  the xor cipher, the key repeats in every file" << std::endl;
+    std::cout << "         chacha20:<passphrase>                  chacha20, each file gets a random nonce, kept on its key line" << std::endl;
+    std::cout << "         aes256ctr:<passphrase>                 aes-256 in counter mode, with a random nonce like chacha20" << std::endl;
+    std::cout << "         <cipher>:<24 hex digits>:<passphrase>  a key line as saved, decrypting with it reuses its nonce" << std::endl;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    program_options options;
+    const bool options_ok = parse_options(argc, argv, options);
+    const stage_summary_writer stage_summary(options_ok ? options.stats_output : std::string());
+
+    // the range mode writes raw bytes to standard output, so it must not print anything else there
+    // the decrypt modes use the key stored in the file unless --key names one, a cipher key given without its nonce picks up
+    // the stored nonce (resolve_cipher_key)
+    const std::string decrypt_key = options.key.empty() ? std::string() : options.cipher_prefix + options.key;
+
+    if (options_ok && !options.range_file.empty())
+    {
+        std::string plain_text;
+        if (!decrypt_range(options.range_file, options.range_offset, options.range_length, decrypt_key, plain_text))
+        {
+            std::cerr << "Could not read file." << std::endl;
+            return 1;
+        }
+#if defined(_WIN32)
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        std::cout.write(plain_text.data(), static_cast<std::streamsize>(plain_text.length()));
+        return std::cout ? 0 : 1;
+    }
+
+    // the pipe mode owns standard output the same way
+    if (options_ok && options.pipe)
+    {
+        // decrypting with no key given takes the key from the stream's header
+        const std::string pipe_key = options.pipe_decrypt ? decrypt_key : add_cipher_nonce(options.cipher_prefix + (options.key.empty() ? "password" : options.key));
+        return pipe_data_stream(options.pipe_decrypt, pipe_key, options.student_name, options.block_size) ? 0 : 1;
+    }
+
     std::cout << "Encyption Decryption Test!" << std::endl;
 
+    if (!options_ok)
+    {
+        print_usage();
+        return 1;
+    }
+
+    if (options.self_test)
+    {
+        return run_self_test() ? 0 : 1;
+    }
+
+    if (options.benchmark)
+    {
+        return run_benchmark_suite(options.benchmark_size, options.threads, options.benchmark_output) ? 0 : 1;
+    }
+
+    if (!options.list_directory.empty())
+    {
+        return list_data_files(options.list_directory, options.threads) ? 0 : 1;
+    }
+
+    if (!options.batch_manifest.empty())
+    {
+        return run_batch(options.batch_manifest, options.threads, options.read_hints) ? 0 : 1;
+    }
+
+    if (!options.decrypt_input.empty())
+    {
+        return decrypt_data_file(options.decrypt_input, options.decrypt_output, decrypt_key, options.threads) ? 0 : 1;
+    }
+
     // input file format
     // Line 1: <students name>
     // Line 2: <Lorem Ipsum Generator website used> https://pirateipsum.me/ (could be https://www.lipsum.com/ or one of https://www.shopify.com/partners/blog/79940998-15-funny-lorem-ipsum-generators-to-shake-up-your-design-mockups)
@@ -125,23 +7269,79 @@ int main()
     const std::string file_name = "inputdatafile.txt";
     const std::string encrypted_file_name = "encrypteddatafile.txt";
     const std::string decrypted_file_name = "decrytpteddatafile.txt";
-    const std::string source_string = read_file(file_name);
-    const std::string key = "password";
+    // the key line of the saved files carries the cipher and its nonce, so every mode and the decrypt modes pick it up from there.
+    // the nonce is fresh each run, which is why encrypt_file_incremental refuses cipher keys
+    const std::string key = add_cipher_nonce(options.cipher_prefix + (options.key.empty() ? "password" : options.key));
 
-    // get the student name from the data file
-    const std::string student_name = get_student_name(source_string);
-
-    // encrypt sourceString with key
-    const std::string encrypted_string = encrypt_decrypt(source_string, key);
-
-    // save encrypted_string to file
-    save_data_file(encrypted_file_name, student_name, key, encrypted_string);
+    if (options.verify)
+    {
+        thread_pool pool(options.threads);
+        if (!encrypt_file_and_verify(file_name, encrypted_file_name, key, pool, options.chunk_size))
+        {
+            return 1;
+        }
+        std::cout << "Read File: " << file_name << " - Encrypted To: " << encrypted_file_name << " - Round Trip Verified" << std::endl;
+        return 0;
+    }
 
-    // decrypt encryptedString with key
-    const std::string decrypted_string = encrypt_decrypt(encrypted_string, key);
+    if (options.incremental)
+    {
+        thread_pool pool(options.threads);
+        if (!encrypt_file_incremental(file_name, encrypted_file_name, key, pool,
+            options.container_chunk_size != 0 ? options.container_chunk_size : default_incremental_chunk_size))
+        {
+            return 1;
+        }
+        std::cout << "Read File: " << file_name << " - Encrypted To: " << encrypted_file_name << std::endl;
+        return 0;
+    }
 
-    // save decrypted_string to file
-    save_data_file(decrypted_file_name, student_name, key, decrypted_string);
+#if !defined(_WIN32)
+    if (options.async)
+    {
+        if (!encrypt_files_async(file_name, encrypted_file_name, decrypted_file_name, key, options.block_size, options.queue_depth, options.allow_uring))
+        {
+            return 1;
+        }
+    }
+    else
+#else
+    // there is no async engine on windows, the plain streaming mode is the closest
+    options.stream = options.stream || options.async;
+#endif
+    if (options.pipeline)
+    {
+        if (!encrypt_files_pipelined(file_name, encrypted_file_name, decrypted_file_name, key, options.block_size, options.queue_depth))
+        {
+            return 1;
+        }
+    }
+    else if (options.stream)
+    {
+        if (!encrypt_files_streaming(file_name, encrypted_file_name, decrypted_file_name, key, options.block_size))
+        {
+            return 1;
+        }
+    }
+    else if (options.container_v2)
+    {
+        thread_pool pool(options.threads);
+        if (!encrypt_files_v2(file_name, encrypted_file_name, decrypted_file_name, key, pool,
+            options.container_chunk_size != 0 ? options.container_chunk_size : default_container_chunk_size))
+        {
+            return 1;
+        }
+    }
+    else if (options.mapped_output)
+    {
+        thread_pool pool(options.threads);
+        encrypt_files_mapped(file_name, encrypted_file_name, decrypted_file_name, key, pool, options.chunk_size);
+    }
+    else
+    {
+        thread_pool pool(options.threads);
+        encrypt_files_in_memory(file_name, encrypted_file_name, decrypted_file_name, key, pool, options.chunk_size, options.read_hints);
+    }
 
     std::cout << "Read File: " << file_name << " - Encrypted To: " << encrypted_file_name << " - Decrypted To: " << decrypted_file_name << std::endl;
 
@@ -149,4 +7349,4 @@ int main()
 }
 
 // Run program: Ctrl + F5 or Debug > Start Without Debugging menu
-// Debug program: F5 or Debug > Start Debugging menu
\ No newline at end of file
+// Debug program: F5 or Debug > Start Debugging menu
\ No newline at end of file